@@ -0,0 +1,85 @@
+#include "async.h"
+
+#include <kassert.h>
+#include "tasking.h"
+
+using namespace os::Async;
+using os::Tasking::Task;
+
+bool Operation::await(Tasking::Waitable& w) {
+  return !w.add_waiter(*this);
+}
+
+void Operation::yield() {
+  m_executor->make_ready(*this);
+}
+
+void Operation::notify() {
+  m_executor->make_ready(*this);
+}
+
+void Executor::spawn(Operation& op) {
+  op.m_executor = this;
+  op.m_resume_point = 0;
+  make_ready(op);
+}
+
+void Executor::make_ready(Operation& op) {
+  Tasking::lock_scheduler();
+  op.m_next_ready = nullptr;
+  if(m_tail == nullptr) {
+    m_head = &op;
+  } else {
+    m_tail->m_next_ready = &op;
+  }
+  m_tail = &op;
+
+  if(m_task) {
+    Tasking::wake(m_task);
+  }
+  Tasking::unlock_scheduler();
+}
+
+size_t Executor::run_ready() {
+  size_t polls = 0;
+  while(true) {
+    Tasking::lock_scheduler();
+    Operation* op = m_head;
+    if(op != nullptr) {
+      m_head = op->m_next_ready;
+      if(m_head == nullptr) m_tail = nullptr;
+    }
+    Tasking::unlock_scheduler();
+
+    if(op == nullptr) return polls;
+
+    polls++;
+    // No switch here, the executor goes on with the next ready operation
+    if(op->poll() == Operation::Status::Done) {
+      op->signal();
+    }
+  }
+}
+
+void Executor::run() {
+  m_task = Task::current();
+
+  while(true) {
+    run_ready();
+
+    // Checking and suspending with interrupts off, so that a wake-up can't
+    // slip in between
+    Tasking::lock_scheduler();
+    if(m_head == nullptr) {
+      m_task->suspend();
+    }
+    Tasking::unlock_scheduler();
+  }
+}
+
+void Executor::start(Tasking::TaskPriority priority) {
+  m_task = Task::start([this]() {
+    Tasking::unlock_scheduler();
+    run();
+  }, priority, Tasking::TaskKind::KernelThread);
+}
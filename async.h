@@ -0,0 +1,144 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "tasking.h"
+
+// Helpers to write Operation::poll() as straight-line code. Every await point
+// records where to resume, so locals that must survive an await have to be
+// members of the operation. Resume points are numbered with __COUNTER__, so
+// several awaits can share a line (e.g. inside another macro).
+//
+//   Status poll() override {
+//     ASYNC_BEGIN();
+//     start_request();
+//     ASYNC_AWAIT(m_request_done);
+//     handle_reply();
+//     ASYNC_END();
+//   }
+#define ASYNC_BEGIN() switch(m_resume_point) { case 0:
+
+// __COUNTER__ is expanded once, as an argument, and offset so that it can't
+// collide with the initial resume point
+#define ASYNC_AWAIT(w) ASYNC_AWAIT_AT(w, __COUNTER__ + 1)
+#define ASYNC_AWAIT_AT(w, point) \
+  do { \
+    m_resume_point = point; \
+    if(!await(w)) return Status::Pending; \
+    [[fallthrough]]; case point:; \
+  } while(0)
+
+#define ASYNC_YIELD() ASYNC_YIELD_AT(__COUNTER__ + 1)
+#define ASYNC_YIELD_AT(point) \
+  do { \
+    m_resume_point = point; \
+    yield(); \
+    return Status::Pending; \
+    case point:; \
+  } while(0)
+
+#define ASYNC_END() } return Status::Done
+
+namespace os {
+  namespace Async {
+    class Executor;
+
+    /**
+     * \brief A stackless unit of asynchronous work, driven by an Executor
+     *
+     * An operation is itself a Waitable: tasks can wait() on it and other
+     * operations can await it. Operations are never allocated by the
+     * executor, their storage belongs to whoever spawns them.
+     */
+    class Operation : public Tasking::Waitable, private Tasking::Waitable::Waiter {
+      friend Executor;
+    public:
+      enum class Status {
+        Pending,
+        Done
+      };
+
+      Operation()
+          : m_resume_point(0)
+          , m_next_ready(nullptr)
+          , m_executor(nullptr) {}
+
+      Operation(const Operation&) = delete;
+      Operation& operator=(const Operation&) = delete;
+
+      Executor* executor() const { return m_executor; }
+
+    protected:
+      /**
+       * \brief Advances the operation until it completes or has to wait
+       */
+      virtual Status poll() = 0;
+
+      /**
+       * \brief Arranges for the operation to be polled again once \p w finishes
+       *
+       * \return true if \p w has already finished and the operation can go on
+       */
+      bool await(Tasking::Waitable& w);
+
+      /**
+       * \brief Puts the operation back at the end of the ready queue
+       */
+      void yield();
+
+      uint32_t m_resume_point;
+
+    private:
+      void notify() override;
+
+      Operation* m_next_ready;
+      Executor* m_executor;
+    };
+
+    /**
+     * \brief Runs operations from a FIFO ready queue on a single task
+     */
+    class Executor {
+      friend Operation;
+    public:
+      Executor()
+          : m_head(nullptr)
+          , m_tail(nullptr)
+          , m_task(nullptr) {}
+
+      Executor(const Executor&) = delete;
+      Executor& operator=(const Executor&) = delete;
+
+      /**
+       * \brief Hands \p op to this executor, it will be polled from its task
+       */
+      void spawn(Operation& op);
+
+      /**
+       * \brief Polls every ready operation until the queue is empty
+       *
+       * \return The number of polls made
+       */
+      size_t run_ready();
+
+      /**
+       * \brief Runs the executor on the calling task, never returns
+       */
+      [[noreturn]] void run();
+
+      /**
+       * \brief Starts a kernel thread running this executor
+       *
+       * \param priority The static priority of the executor's task
+       */
+      void start(Tasking::TaskPriority priority = Tasking::TaskPriority::Normal);
+
+    private:
+      void make_ready(Operation& op);
+
+      Operation* m_head;
+      Operation* m_tail;
+      Tasking::task_ref m_task;
+    };
+  }
+}
@@ -0,0 +1,198 @@
+#include "bench.h"
+
+#include <stdint.h>
+#include <stddef.h>
+#include <kassert.h>
+#include <div64.h>
+#include "screen.h"
+#include "kheap.h"
+#include "cpu.h"
+#include "memory.h"
+#include <priority_queue.h>
+#include <intrusive_ptr.h>
+#include <object_pool.h>
+#include <vector.h>
+
+using os::Screen;
+
+// Bytes moved per measurement, whatever the block size
+constexpr size_t bytes_per_run = 4 << 20;
+constexpr size_t buffer_size = 64 << 10;
+
+static uint32_t megabytes_per_second(uint64_t bytes, uint64_t ticks) {
+  uint64_t us = os::Cpu::timestampToMicroseconds(ticks);
+  if(us == 0) us = 1;
+  // Bytes per microsecond is MB/s
+  return (uint32_t)os::div64(bytes, (uint32_t)us);
+}
+
+template<typename F>
+static uint32_t measure(size_t size, F&& f) {
+  size_t iterations = bytes_per_run / size;
+  uint64_t start = os::Cpu::timestamp();
+  for(size_t i = 0; i < iterations; i++) f();
+  return megabytes_per_second((uint64_t)iterations * size, os::Cpu::timestamp() - start);
+}
+
+void os::Benchmark::memory() {
+  Screen& screen = Screen::getInstance();
+
+  // Offset by a few bytes so that the alignment prologues are exercised
+  uint8_t* src = static_cast<uint8_t*>(kmalloc(buffer_size + 16));
+  uint8_t* dst = static_cast<uint8_t*>(kmalloc(buffer_size + 16));
+  if(src == nullptr || dst == nullptr) panic("Out of memory for benchmark buffers");
+
+  const size_t sizes[] = {16, 64, 256, 1024, 4096, buffer_size};
+  const size_t offsets[] = {0, 3};
+
+  size_t count;
+  const os::Memory::Variant* variants = os::Memory::variants(count);
+
+  screen.write("memcpy/memset MB/s (size offset: copy set)\n");
+  for(size_t v = 0; v < count; v++) {
+    screen.write("%:\n", variants[v].name);
+    for(size_t size : sizes) {
+      for(size_t offset : offsets) {
+        uint8_t* d = dst + offset;
+        uint8_t* s = src + 1;
+        uint32_t copy = measure(size, [&]() { variants[v].copy(d, s, size); });
+        uint32_t set = measure(size, [&]() { variants[v].set(d, 0x5A, size); });
+        screen.write("  % %: % %\n", (uint32_t)size, (uint32_t)offset, copy, set);
+      }
+    }
+  }
+
+  kfree(src);
+  kfree(dst);
+}
+
+// The recursive binary heap priority_queue used before it became a 4-ary
+// heap, kept as the baseline
+template<typename T>
+class LegacyHeap {
+public:
+  const T& top() const {
+    return m_container.front();
+  }
+
+  void push(const T& v) {
+    m_container.push_back(v);
+    bubble_up(m_container.size());
+  }
+
+  void pop() {
+    m_container[0] = m_container.back();
+    m_container.pop_back();
+    heapify(1);
+  }
+
+  bool empty() const {
+    return m_container.empty();
+  }
+
+private:
+  os::std::vector<T> m_container;
+
+  void heapify(size_t i) {
+    size_t l = i * 2;
+    size_t r = i * 2 + 1;
+    size_t largest;
+    if(l <= m_container.size() && os::std::less<T>()(m_container[l - 1], m_container[i - 1])) {
+      largest = l;
+    } else {
+      largest = i;
+    }
+
+    if(r <= m_container.size() && os::std::less<T>()(m_container[r - 1], m_container[largest - 1])) {
+      largest = r;
+    }
+
+    if(largest != i) {
+      auto tmp = m_container[i - 1];
+      m_container[i - 1] = m_container[largest - 1];
+      m_container[largest - 1] = tmp;
+      heapify(largest);
+    }
+  }
+
+  void bubble_up(size_t i) {
+    size_t parent = i / 2;
+    while(i > 1 && os::std::less<T>()(m_container[i - 1], m_container[parent - 1])) {
+      auto tmp = m_container[i - 1];
+      m_container[i - 1] = m_container[parent - 1];
+      m_container[parent - 1] = tmp;
+      i = parent;
+      parent = i / 2;
+    }
+  }
+};
+
+namespace {
+  struct Item : os::RefCounted<Item> {
+    uint32_t priority;
+
+    static void* operator new(size_t) {
+      return os::ObjectPool<Item>::instance().allocate();
+    }
+
+    static void operator delete(void* p) {
+      os::ObjectPool<Item>::instance().deallocate(static_cast<Item*>(p));
+    }
+  };
+}
+
+namespace os {
+  namespace std {
+    template<>
+    struct less<Item*> {
+      bool operator()(const Item* a, const Item* b) const {
+        return a->priority < b->priority;
+      }
+    };
+  }
+}
+
+constexpr size_t heap_elements = 4096;
+
+// Pseudo-random priorities, the same sequence for every queue
+static uint32_t next_priority(uint32_t& state) {
+  state ^= state << 13;
+  state ^= state >> 17;
+  state ^= state << 5;
+  return state;
+}
+
+// Microseconds to push heap_elements values and pop them all
+template<typename Queue, typename Make>
+static uint32_t measure_heap(Make&& make) {
+  Queue q;
+  uint32_t state = 2463534242u;
+  uint64_t start = os::Cpu::timestamp();
+  for(size_t i = 0; i < heap_elements; i++) q.push(make(next_priority(state)));
+  while(!q.empty()) q.pop();
+  return (uint32_t)os::Cpu::timestampToMicroseconds(os::Cpu::timestamp() - start);
+}
+
+void os::Benchmark::heap() {
+  Screen& screen = Screen::getInstance();
+  screen.write("priority queues, % pushes then pops (us)\n", (uint32_t)heap_elements);
+
+  auto makeInt = [](uint32_t p) { return p; };
+  screen.write("  uint32_t: binary % 4-ary %\n",
+    measure_heap<LegacyHeap<uint32_t>>(makeInt),
+    measure_heap<os::std::priority_queue<uint32_t>>(makeInt));
+
+  // Reference counted elements, where copies mean count updates. items owns
+  // one reference to each for the whole run, the queues only add their own.
+  os::std::vector<intrusive_ptr<Item>> items;
+  items.reserve(heap_elements);
+  uint32_t state = 1;
+  for(size_t i = 0; i < heap_elements; i++) {
+    items.push_back(new Item());
+    items.back()->priority = next_priority(state);
+  }
+  auto makeRef = [&](uint32_t p) { return items[p % heap_elements]; };
+  screen.write("  intrusive_ptr: binary % 4-ary %\n",
+    measure_heap<LegacyHeap<intrusive_ptr<Item>>>(makeRef),
+    measure_heap<os::std::priority_queue<intrusive_ptr<Item>>>(makeRef));
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+namespace os {
+  // Boot time micro-benchmarks, built when the kernel is made with
+  // BENCHMARKS=1. Results are printed on the screen.
+  namespace Benchmark {
+    /**
+     * \brief Measures every memcpy/memset variant over a range of sizes
+     *
+     * Must be called after Paging::init
+     */
+    void memory();
+
+    /**
+     * \brief Compares priority_queue with the binary heap it replaced
+     *
+     * Must be called after Paging::init
+     */
+    void heap();
+  }
+}
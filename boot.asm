@@ -39,6 +39,8 @@ mboot:
 
 start:
   mov esp, stack_end
+  and esp, -16                  ; The arguments of kmain start on a 16 byte
+  sub esp, 12                   ; boundary, as after a call from C code
   push ebx                      ; Load multiboot header location
 
   ; Execute the kernel:
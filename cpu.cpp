@@ -0,0 +1,123 @@
+#include "cpu.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <div64.h>
+#include "time.h"
+
+using os::Cpu::Feature;
+
+struct CpuidRegs {
+  uint32_t eax, ebx, ecx, edx;
+};
+
+static CpuidRegs cpuid(uint32_t leaf, uint32_t subleaf = 0) {
+  CpuidRegs r;
+  asm volatile("cpuid"
+    : "=a"(r.eax), "=b"(r.ebx), "=c"(r.ecx), "=d"(r.edx)
+    : "a"(leaf), "c"(subleaf));
+  return r;
+}
+
+static uint32_t featureMask = 0;
+static char vendorString[13];
+
+static uint64_t readTsc() {
+  uint32_t low, high;
+  asm volatile("rdtsc" : "=a"(low), "=d"(high));
+  return ((uint64_t)high << 32) | low;
+}
+
+static uint64_t readTimer() {
+  return os::Time::since_boot().nanoseconds();
+}
+
+static uint64_t (*clockSource)() = readTimer;
+static uint32_t clockKhz = 1'000'000; // Nanoseconds
+
+static void set(Feature f, bool supported) {
+  if(supported) featureMask |= 1u << static_cast<uint32_t>(f);
+}
+
+void os::Cpu::init() {
+  CpuidRegs r = cpuid(0);
+  uint32_t maxLeaf = r.eax;
+  memcpy(&vendorString[0], &r.ebx, 4);
+  memcpy(&vendorString[4], &r.edx, 4);
+  memcpy(&vendorString[8], &r.ecx, 4);
+  vendorString[12] = 0;
+
+  if(maxLeaf >= 1) {
+    r = cpuid(1);
+    set(Feature::FPU,     r.edx & (1 << 0));
+    set(Feature::PSE,     r.edx & (1 << 3));
+    set(Feature::TSC,     r.edx & (1 << 4));
+    set(Feature::APIC,    r.edx & (1 << 9));
+    set(Feature::PGE,     r.edx & (1 << 13));
+    set(Feature::CLFLUSH, r.edx & (1 << 19));
+    set(Feature::FXSR,    r.edx & (1 << 24));
+    set(Feature::SSE,     r.edx & (1 << 25));
+    set(Feature::SSE2,    r.edx & (1 << 26));
+    set(Feature::SSE3,    r.ecx & (1 << 0));
+    set(Feature::SSSE3,   r.ecx & (1 << 9));
+    set(Feature::SSE41,   r.ecx & (1 << 19));
+    set(Feature::SSE42,   r.ecx & (1 << 20));
+    set(Feature::POPCNT,  r.ecx & (1 << 23));
+  }
+
+  if(maxLeaf >= 7) {
+    r = cpuid(7, 0);
+    set(Feature::ERMS, r.ebx & (1 << 9));
+  }
+
+  r = cpuid(0x80000000);
+  if(r.eax >= 0x80000007) {
+    r = cpuid(0x80000007);
+    set(Feature::InvariantTSC, r.edx & (1 << 8));
+  }
+
+  if(has(Feature::TSC)) {
+    clockSource = readTsc;
+    clockKhz = 1'000'000; // Assume 1 GHz until calibrated
+  }
+}
+
+void os::Cpu::calibrate() {
+  if(!has(Feature::TSC)) return;
+
+  // Align on a timer tick, then count TSC cycles for about 100 ms
+  auto start = os::Time::since_boot();
+  while(os::Time::since_boot().nanoseconds() == start.nanoseconds()) { asm volatile("pause"); }
+  start = os::Time::since_boot();
+  uint64_t tscStart = readTsc();
+
+  uint64_t end;
+  do {
+    asm volatile("pause");
+    end = os::Time::since_boot().nanoseconds();
+  } while(end - start.nanoseconds() < 100'000'000);
+  uint64_t cycles = readTsc() - tscStart;
+
+  uint32_t elapsedMs = (uint32_t)(end - start.nanoseconds()) / 1'000'000;
+  clockKhz = (uint32_t)div64(cycles, elapsedMs);
+}
+
+uint32_t os::Cpu::features() {
+  return featureMask;
+}
+
+const char* os::Cpu::vendor() {
+  return vendorString;
+}
+
+uint64_t os::Cpu::timestamp() {
+  return clockSource();
+}
+
+uint32_t os::Cpu::timestampKhz() {
+  return clockKhz;
+}
+
+uint64_t os::Cpu::timestampToMicroseconds(uint64_t ticks) {
+  return div64(ticks * 1000, clockKhz);
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <stdint.h>
+
+namespace os {
+  namespace Cpu {
+    enum class Feature : uint32_t {
+      FPU,
+      TSC,
+      PSE,
+      PGE,
+      APIC,
+      CLFLUSH,
+      FXSR,
+      SSE,
+      SSE2,
+      SSE3,
+      SSSE3,
+      SSE41,
+      SSE42,
+      POPCNT,
+      ERMS,
+      InvariantTSC
+    };
+
+    /**
+     * \brief Queries CPUID and fills the feature mask
+     *
+     * Must run once at boot, before anything that dispatches on features
+     */
+    void init();
+
+    /**
+     * \brief Measures the timestamp frequency against the timer
+     *
+     * Needs the timer interrupt running. Until called, the frequency is a
+     * conservative guess.
+     */
+    void calibrate();
+
+    /**
+     * \brief Returns the detected features, bit n is set if Feature(n) is supported
+     */
+    uint32_t features();
+
+    inline bool has(Feature f) {
+      return features() & (1u << static_cast<uint32_t>(f));
+    }
+
+    /**
+     * \brief Returns the 12 character CPUID vendor string
+     */
+    const char* vendor();
+
+    /**
+     * \brief Reads the fastest monotonic clock available: the TSC if there is
+     * one, the timer's nanoseconds since boot otherwise
+     */
+    uint64_t timestamp();
+
+    /**
+     * \brief Returns how many timestamp() units make a millisecond
+     */
+    uint32_t timestampKhz();
+
+    /**
+     * \brief Converts a timestamp() difference into microseconds
+     */
+    uint64_t timestampToMicroseconds(uint64_t ticks);
+  }
+}
@@ -10,6 +10,35 @@ void debug_write(const char *c) {
   }
 }
 
+void debug_put(char c) {
+  outb(0xE9, c);
+}
+
+void debug_write_decimal(uint32_t n) {
+  char c[11];
+  int i = sizeof(c) - 1;
+  c[i] = 0;
+  do {
+    c[--i] = '0' + n % 10;
+    n /= 10;
+  } while(n > 0);
+  debug_write(&c[i]);
+}
+
+void debug_write_hexadecimal(uint32_t n) {
+  char c[11];
+  int i = sizeof(c) - 1;
+  c[i] = 0;
+  do {
+    uint32_t digit = n & 0xF;
+    c[--i] = digit >= 0xA ? digit - 0xA + 'a' : digit + '0';
+    n >>= 4;
+  } while(n > 0);
+  c[--i] = 'x';
+  c[--i] = '0';
+  debug_write(&c[i]);
+}
+
 void debug_break() {
   outw(0x8A00, 0x8A00);
   outw(0x8A00, 0x08AE0);
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <stdint.h>
+
 /**
  * \brief Writes a string to the Bochs' console
  * 
@@ -7,6 +9,48 @@
  */
 void debug_write(const char *c);
 
+void debug_put(char c);
+void debug_write_decimal(uint32_t n);
+void debug_write_hexadecimal(uint32_t n);
+
+/**
+ * \brief Formatted output to the Bochs' console, with the same rules as
+ * Screen::write: every % is replaced by the next argument
+ */
+inline void debug_print(const char *c) {
+  debug_write(c);
+}
+
+inline void debug_print(uint32_t v) {
+  debug_write_decimal(v);
+}
+
+inline void debug_print(const void* v) {
+  debug_write_hexadecimal((uint32_t)v);
+}
+
+template<typename T, typename... Targs>
+void debug_print(const char *format, T a, Targs... b) {
+  while(*format) {
+    if(*format == '%') {
+      format++;
+
+      if(*format == '%') {
+        debug_put('%');
+        format++;
+        continue;
+      }
+
+      debug_print(a);
+      debug_print(format, b...);
+      break;
+    } else {
+      debug_put(*format);
+      format++;
+    }
+  }
+}
+
 /**
  * \brief Causes Bochs to pause execution
  * 
@@ -0,0 +1,93 @@
+#include "deferred.h"
+
+#include <stddef.h>
+#include <percpu.h>
+#include <ring_buffer.h>
+#include "tasking.h"
+
+using namespace os::Deferred;
+
+// How many items are popped from a queue at once
+constexpr size_t batch_size = 16;
+
+struct CpuQueues {
+  os::MpscRingBuffer<WorkItem, 256> softirqs;
+  os::MpscRingBuffer<WorkItem, 256> work;
+  os::Tasking::task_ref worker;
+  bool in_softirq;
+};
+
+static os::PerCpu<CpuQueues> cpus;
+
+template<typename Queue>
+static size_t run_batch(Queue& queue) {
+  WorkItem batch[batch_size];
+  size_t n = queue.pop(batch, batch_size);
+  for(size_t i = 0; i < n; i++) {
+    batch[i].func(batch[i].data);
+  }
+  return n;
+}
+
+static void worker_main() {
+  os::Tasking::unlock_scheduler();
+  auto& cpu = cpus.local();
+
+  while(true) {
+    while(run_batch(cpu.work) > 0) {;}
+
+    // Checking and suspending with interrupts off, so that a wake-up from an
+    // IRQ handler can't slip in between
+    os::Tasking::lock_scheduler();
+    if(cpu.work.empty()) {
+      cpu.worker->suspend();
+    }
+    os::Tasking::unlock_scheduler();
+  }
+}
+
+void os::Deferred::init() {
+  for(size_t i = 0; i < cpus.size(); i++) {
+    cpus[i].worker = os::Tasking::Task::start(&worker_main, os::Tasking::TaskPriority::RealTime,
+                                              os::Tasking::TaskKind::KernelThread);
+  }
+}
+
+bool os::Deferred::queue_softirq(work_function* func, void* data) {
+  return cpus.local().softirqs.push({func, data});
+}
+
+bool os::Deferred::queue_work(work_function* func, void* data) {
+  auto& cpu = cpus.local();
+  if(!cpu.work.push({func, data})) return false;
+
+  if(cpu.worker) {
+    os::Tasking::wake(cpu.worker);
+  }
+  return true;
+}
+
+void os::Deferred::run_softirqs() {
+  auto& cpu = cpus.local();
+  if(cpu.in_softirq) return;
+
+  cpu.in_softirq = true;
+  do {
+    asm volatile("sti");
+    while(run_batch(cpu.softirqs) > 0) {;}
+    asm volatile("cli");
+    // A nested interrupt may have queued more work after the last pop
+  } while(!cpu.softirqs.empty());
+  cpu.in_softirq = false;
+}
+
+bool os::Deferred::save_softirq_state() {
+  auto& cpu = cpus.local();
+  bool in_softirq = cpu.in_softirq;
+  cpu.in_softirq = false;
+  return in_softirq;
+}
+
+void os::Deferred::restore_softirq_state(bool in_softirq) {
+  cpus.local().in_softirq = in_softirq;
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <stddef.h>
+
+namespace os {
+  namespace Deferred {
+    using work_function = void(void*);
+
+    struct WorkItem {
+      work_function* func;
+      void* data;
+    };
+
+    /**
+     * \brief Starts the worker tasks that run queued work
+     *
+     * Must be called after Tasking::init
+     */
+    void init();
+
+    /**
+     * \brief Queues a function to be run at the end of the current interrupt,
+     * after the EOI has been sent and with interrupts enabled
+     *
+     * Softirq functions must not block. Safe to call from interrupt handlers.
+     *
+     * \param func The function to run
+     * \param data The argument passed to \p func
+     * \return false if the queue is full and the work was dropped
+     */
+    bool queue_softirq(work_function* func, void* data = nullptr);
+
+    /**
+     * \brief Queues a function to be run by this CPU's worker task
+     *
+     * Work functions run at TaskPriority::RealTime in task context, so they
+     * are allowed to block. Safe to call from interrupt handlers.
+     *
+     * \param func The function to run
+     * \param data The argument passed to \p func
+     * \return false if the queue is full and the work was dropped
+     */
+    bool queue_work(work_function* func, void* data = nullptr);
+
+    /**
+     * \brief Runs the pending softirqs of the current CPU
+     *
+     * Called by the IRQ dispatcher on the way out of every interrupt.
+     * Nested calls return immediately, the outermost one drains the queue.
+     */
+    void run_softirqs();
+
+    /**
+     * \brief Takes the current CPU's softirq flag away from the task that is
+     * being switched out
+     *
+     * Softirqs can switch tasks, and the task switched to must be able to run
+     * softirqs of its own. Called by the scheduler around every switch.
+     *
+     * \return Whether the outgoing task was running softirqs
+     */
+    bool save_softirq_state();
+
+    /**
+     * \brief Gives the flag back when the task is switched in again
+     *
+     * \param in_softirq The value returned by save_softirq_state
+     */
+    void restore_softirq_state(bool in_softirq);
+  }
+}
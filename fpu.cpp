@@ -0,0 +1,189 @@
+#include "fpu.h"
+
+#include <stdint.h>
+#include <stddef.h>
+#include <kassert.h>
+#include "interrupts.h"
+#include "kheap.h"
+#include "cpu.h"
+
+struct os::Fpu::Context {
+  alignas(16) uint8_t area[512]; // FXSAVE image (or the 108 bytes of FSAVE)
+  void* allocation;
+};
+
+using os::Fpu::Context;
+
+constexpr uint32_t CR0_MP = 1 << 1;
+constexpr uint32_t CR0_EM = 1 << 2;
+constexpr uint32_t CR0_TS = 1 << 3;
+constexpr uint32_t CR0_NE = 1 << 5;
+
+constexpr uint32_t CR4_OSFXSR     = 1 << 9;
+constexpr uint32_t CR4_OSXMMEXCPT = 1 << 10;
+
+static bool present = false;
+static bool fxsr = false;
+static bool sse = false;
+
+// Slot of the task whose state is currently loaded in the FPU registers
+static Context** owner = nullptr;
+// Slot of the running task
+static Context** current = nullptr;
+
+static inline void setTaskSwitched() {
+  uint32_t cr0;
+  asm volatile("mov %%cr0, %0" : "=r"(cr0));
+  asm volatile("mov %0, %%cr0" :: "r"(cr0 | CR0_TS));
+}
+
+static inline void clearTaskSwitched() {
+  asm volatile("clts");
+}
+
+static void save(Context* ctx) {
+  if(fxsr) {
+    asm volatile("fxsave %0" : "=m"(ctx->area));
+  } else {
+    asm volatile("fnsave %0" : "=m"(ctx->area));
+  }
+}
+
+static void restore(Context* ctx) {
+  if(fxsr) {
+    asm volatile("fxrstor %0" :: "m"(ctx->area));
+  } else {
+    asm volatile("frstor %0" :: "m"(ctx->area));
+  }
+}
+
+static void resetState() {
+  asm volatile("fninit");
+  if(sse) {
+    uint32_t mxcsr = 0x1F80; // All exceptions masked
+    asm volatile("ldmxcsr %0" :: "m"(mxcsr));
+  }
+}
+
+static Context* allocContext() {
+  void* mem = kmalloc(sizeof(Context) + alignof(Context) - 1);
+  if(mem == nullptr) panic("Out of memory for FPU context");
+  uintptr_t aligned = ((uintptr_t)mem + alignof(Context) - 1) & ~(alignof(Context) - 1);
+  Context* ctx = (Context*)aligned;
+  ctx->allocation = mem;
+  return ctx;
+}
+
+// #NM: a task used the FPU while CR0.TS was set
+static void deviceNotAvailable(os::Interrupts::Registers*) {
+  clearTaskSwitched();
+  if(owner == current) return;
+
+  if(owner != nullptr && *owner != nullptr) {
+    save(*owner);
+  }
+
+  if(current == nullptr) {
+    // Nobody to account the state to yet (tasking not initialized)
+    resetState();
+  } else if(*current == nullptr) {
+    *current = allocContext();
+    resetState();
+  } else {
+    restore(*current);
+  }
+  owner = current;
+}
+
+void os::Fpu::init() {
+  using os::Cpu::Feature;
+
+  present = os::Cpu::has(Feature::FPU);
+  if(!present) return;
+
+  fxsr = os::Cpu::has(Feature::FXSR);
+  sse = fxsr && os::Cpu::has(Feature::SSE);
+
+  uint32_t cr0;
+  asm volatile("mov %%cr0, %0" : "=r"(cr0));
+  cr0 &= ~(CR0_EM | CR0_TS);
+  cr0 |= CR0_MP | CR0_NE;
+  asm volatile("mov %0, %%cr0" :: "r"(cr0));
+
+  if(sse) {
+    uint32_t cr4;
+    asm volatile("mov %%cr4, %0" : "=r"(cr4));
+    cr4 |= CR4_OSFXSR | CR4_OSXMMEXCPT;
+    asm volatile("mov %0, %%cr4" :: "r"(cr4));
+  }
+
+  resetState();
+
+  os::Interrupts::registerInterruptHandler(7, deviceNotAvailable);
+}
+
+bool os::Fpu::sseEnabled() {
+  return sse;
+}
+
+void os::Fpu::switchTo(Context** next) {
+  if(!present) return;
+
+  current = next;
+  if(next == owner) {
+    clearTaskSwitched();
+  } else {
+    setTaskSwitched();
+  }
+}
+
+void os::Fpu::adopt(Context** ctx) {
+  if(!present) return;
+
+  // Nothing to save yet: the registers stay live, the context is only
+  // written once another task takes the FPU
+  *ctx = allocContext();
+  current = ctx;
+  owner = ctx;
+  clearTaskSwitched();
+}
+
+void os::Fpu::release(Context** ctx) {
+  if(owner == ctx) owner = nullptr;
+  if(current == ctx) current = nullptr;
+
+  if(*ctx != nullptr) {
+    kfree((*ctx)->allocation);
+    *ctx = nullptr;
+  }
+}
+
+os::Fpu::KernelSection::KernelSection() {
+  asm volatile("pushf; pop %0; cli" : "=r"(m_eflags) :: "memory");
+
+  uint32_t cr0;
+  asm volatile("mov %%cr0, %0" : "=r"(cr0));
+  m_taskSwitched = cr0 & CR0_TS;
+  if(m_taskSwitched) clearTaskSwitched();
+
+  // Unaligned moves: nothing guarantees a 16 byte aligned stack, whatever
+  // alignas says GCC doesn't realign the frame
+  asm volatile(
+    "movdqu %%xmm0, 0(%0)\n\t"
+    "movdqu %%xmm1, 16(%0)\n\t"
+    "movdqu %%xmm2, 32(%0)\n\t"
+    "movdqu %%xmm3, 48(%0)"
+    :: "r"(m_saved) : "memory");
+}
+
+os::Fpu::KernelSection::~KernelSection() {
+  asm volatile(
+    "movdqu 0(%0), %%xmm0\n\t"
+    "movdqu 16(%0), %%xmm1\n\t"
+    "movdqu 32(%0), %%xmm2\n\t"
+    "movdqu 48(%0), %%xmm3"
+    :: "r"(m_saved) : "memory");
+
+  if(m_taskSwitched) setTaskSwitched();
+  asm volatile("push %0; popf" :: "r"(m_eflags) : "memory", "cc");
+}
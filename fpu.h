@@ -0,0 +1,74 @@
+#pragma once
+
+#include <stdint.h>
+
+namespace os {
+  namespace Fpu {
+    // A task's saved x87/SSE register state, allocated the first time the
+    // task touches the FPU
+    struct Context;
+
+    /**
+     * \brief Enables the FPU, and SSE if the CPU supports FXSAVE/FXRSTOR,
+     * and installs the lazy switching handler for #NM
+     *
+     * Must be called after Cpu::init
+     */
+    void init();
+
+    /**
+     * \brief Whether SSE instructions are enabled
+     */
+    bool sseEnabled();
+
+    /**
+     * \brief Called on every context switch with the incoming task's context
+     *
+     * The state is not switched here: CR0.TS is set instead, so that the
+     * first FPU instruction of the new task traps and the state is swapped
+     * then. Tasks that never touch the FPU never pay for it.
+     *
+     * \param next The slot holding the incoming task's context
+     */
+    void switchTo(Context** next);
+
+    /**
+     * \brief Makes the current register state the state of a task, for the
+     * task that is already running when tasking starts
+     *
+     * \param ctx The slot for the task's context, empty
+     */
+    void adopt(Context** ctx);
+
+    /**
+     * \brief Frees a task's context when the task is destroyed
+     *
+     * \param ctx The slot holding the task's context
+     */
+    void release(Context** ctx);
+
+    /**
+     * \brief Lets kernel code use xmm0-xmm3 for the lifetime of the object,
+     * without a context of its own
+     *
+     * Whatever the registers hold (the FPU owner's state) is saved on entry
+     * and restored on exit, with interrupts disabled in between so that
+     * neither a task switch nor a nested section can observe them. Only
+     * valid when sseEnabled() is true. Meant for short bursts such as
+     * copying or clearing pages.
+     */
+    class KernelSection {
+    public:
+      KernelSection();
+      ~KernelSection();
+
+      KernelSection(const KernelSection&) = delete;
+      KernelSection& operator=(const KernelSection&) = delete;
+
+    private:
+      uint8_t m_saved[4 * 16];
+      uint32_t m_eflags;
+      bool m_taskSwitched;
+    };
+  }
+}
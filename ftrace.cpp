@@ -0,0 +1,218 @@
+#include "ftrace.h"
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic.h>
+#include <new.h>
+#include <percpu.h>
+#include <ring_buffer.h>
+#include <flat_hash_map.h>
+#include <vector.h>
+#include <pair.h>
+#include <algorithm.h>
+#include <kassert.h>
+#include "kheap.h"
+#include "cpu.h"
+#include "reflection.h"
+#include "debug.h"
+
+// Everything here runs inside the hooks or with tracing stopped, and is
+// excluded from instrumentation in the Makefile. The hooks are marked as
+// well, in case the file list gets out of sync.
+#define NO_TRACE __attribute__((no_instrument_function))
+
+enum class EventKind : uint32_t {
+  Enter,
+  Exit
+};
+
+struct Event {
+  uint64_t timestamp;
+  uintptr_t function;
+  EventKind kind;
+};
+
+// 1 MB per CPU
+using EventRing = os::SpscRingBuffer<Event, 65536>;
+
+struct CpuTrace {
+  EventRing* ring;
+  // Set while a hook runs. Whatever it calls, and interrupts arriving in the
+  // meantime, are not recorded, so the ring only ever has one producer.
+  volatile bool inHook;
+  // Events lost because the ring was full
+  uint32_t dropped;
+};
+
+static os::std::atomic<bool> active;
+static os::PerCpu<CpuTrace> cpus;
+static uint64_t traceStart = 0;
+
+extern "C" {
+  void __cyg_profile_func_enter(void* fn, void* site) NO_TRACE;
+  void __cyg_profile_func_exit(void* fn, void* site) NO_TRACE;
+}
+
+static inline void record(uintptr_t fn, EventKind kind) NO_TRACE;
+static inline void record(uintptr_t fn, EventKind kind) {
+  if(!active.load(os::std::memory_order_relaxed)) return;
+
+  CpuTrace& cpu = cpus.local();
+  if(cpu.inHook) return;
+  cpu.inHook = true;
+
+  if(!cpu.ring->push({os::Cpu::timestamp(), fn, kind})) {
+    cpu.dropped++;
+  }
+
+  cpu.inHook = false;
+}
+
+void __cyg_profile_func_enter(void* fn, void*) {
+  record((uintptr_t)fn, EventKind::Enter);
+}
+
+void __cyg_profile_func_exit(void* fn, void*) {
+  record((uintptr_t)fn, EventKind::Exit);
+}
+
+static void discard(EventRing& ring) {
+  Event batch[16];
+  while(ring.pop(batch, 16) > 0) {;}
+}
+
+void os::FunctionTrace::start() {
+  stop();
+
+  for(size_t i = 0; i < cpus.size(); i++) {
+    CpuTrace& cpu = cpus[i];
+    if(cpu.ring == nullptr) {
+      void* mem = vmalloc(sizeof(EventRing));
+      if(mem == nullptr) panic("Out of memory for the function trace");
+      cpu.ring = new (mem) EventRing();
+    }
+    discard(*cpu.ring);
+    cpu.dropped = 0;
+  }
+
+  traceStart = os::Cpu::timestamp();
+  active.store(true, os::std::memory_order_release);
+}
+
+void os::FunctionTrace::stop() {
+  active.store(false, os::std::memory_order_release);
+}
+
+bool os::FunctionTrace::running() {
+  return active.load(os::std::memory_order_relaxed);
+}
+
+static uint32_t dropped() {
+  uint32_t n = 0;
+  for(size_t i = 0; i < cpus.size(); i++) {
+    n += cpus[i].dropped;
+  }
+  return n;
+}
+
+static const char* nameOf(uintptr_t function) {
+  const char* name = os::Reflection::getSymbolName(function).first;
+  return *name ? name : "[unknown]";
+}
+
+// Calls that are still open while replaying a CPU's events
+struct OpenCall {
+  uintptr_t function;
+  uint64_t timestamp;
+};
+
+struct CallStats {
+  uint32_t calls;
+  uint64_t total;
+  uint64_t max;
+};
+
+void os::FunctionTrace::dump(size_t maxFunctions) {
+  stop();
+
+  os::flat_hash_map<uintptr_t, CallStats> stats;
+  for(size_t i = 0; i < cpus.size(); i++) {
+    CpuTrace& cpu = cpus[i];
+    if(cpu.ring == nullptr) continue;
+
+    // Task stacks are a single page, keep this small
+    constexpr size_t max_depth = 32;
+    OpenCall open[max_depth];
+    size_t depth = 0;
+
+    Event batch[16];
+    size_t n;
+    while((n = cpu.ring->pop(batch, 16)) > 0) {
+      for(size_t j = 0; j < n; j++) {
+        const Event& e = batch[j];
+        if(e.kind == EventKind::Enter) {
+          // Too deep, drop the outermost call
+          if(depth == max_depth) {
+            for(size_t k = 1; k < max_depth; k++) open[k - 1] = open[k];
+            depth--;
+          }
+          open[depth++] = {e.function, e.timestamp};
+          continue;
+        }
+
+        // Exits without a matching entry (recorded before start(), or lost)
+        // are ignored, calls that never exited are abandoned
+        size_t k = depth;
+        while(k > 0 && open[k - 1].function != e.function) k--;
+        if(k == 0) continue;
+        depth = k - 1;
+
+        uint64_t elapsed = e.timestamp - open[depth].timestamp;
+        CallStats& s = stats[e.function];
+        s.calls++;
+        s.total += elapsed;
+        if(elapsed > s.max) s.max = elapsed;
+      }
+    }
+  }
+
+  debug_print("Function trace: % functions, % events dropped\n", (uint32_t)stats.size(), dropped());
+
+  os::std::vector<os::std::pair<uintptr_t, CallStats>> functions;
+  functions.reserve(stats.size());
+  for(auto& entry : stats) {
+    functions.push_back({entry.first, entry.second});
+  }
+  os::std::sort(functions.begin(), functions.end(), [](const auto& a, const auto& b) {
+    return a.second.total > b.second.total;
+  });
+
+  debug_write("  calls total_us avg_us max_us function\n");
+  for(size_t i = 0; i < functions.size() && i < maxFunctions; i++) {
+    const CallStats& s = functions[i].second;
+    uint32_t total = (uint32_t)os::Cpu::timestampToMicroseconds(s.total);
+    uint32_t max = (uint32_t)os::Cpu::timestampToMicroseconds(s.max);
+    debug_print("  % % % % %\n", s.calls, total, total / s.calls, max, nameOf(functions[i].first));
+  }
+}
+
+void os::FunctionTrace::dumpEvents() {
+  stop();
+
+  debug_print("Function trace events, % dropped\n", dropped());
+  for(size_t i = 0; i < cpus.size(); i++) {
+    CpuTrace& cpu = cpus[i];
+    if(cpu.ring == nullptr) continue;
+
+    Event batch[16];
+    size_t n;
+    while((n = cpu.ring->pop(batch, 16)) > 0) {
+      for(size_t j = 0; j < n; j++) {
+        const Event& e = batch[j];
+        uint32_t us = (uint32_t)os::Cpu::timestampToMicroseconds(e.timestamp - traceStart);
+        debug_print("% % % %\n", (uint32_t)i, us, e.kind == EventKind::Enter ? "E" : "X",
+          nameOf(e.function));
+      }
+    }
+  }
+}
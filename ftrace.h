@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stddef.h>
+
+namespace os {
+  // Function entry/exit tracing. When the kernel is built with FTRACE=1,
+  // GCC calls a hook on entry to and exit from every function, which
+  // records a timestamped event into a per-CPU ring while tracing is on.
+  // Without FTRACE=1 nothing calls the hooks and the trace stays empty.
+  namespace FunctionTrace {
+    /**
+     * \brief Discards the previous trace and starts recording
+     *
+     * The rings are allocated the first time, so this must be called after
+     * Paging::init
+     */
+    void start();
+
+    /**
+     * \brief Stops recording, what was recorded is kept until dumped
+     */
+    void stop();
+
+    bool running();
+
+    /**
+     * \brief Prints per function call counts and latencies on the debug port
+     *
+     * Entries are matched with exits per CPU, so a call that is switched
+     * away from in the middle also counts the time other tasks ran. Stops
+     * tracing and consumes the recorded events.
+     *
+     * \param maxFunctions How many functions to list, by total time
+     */
+    void dump(size_t maxFunctions = 30);
+
+    /**
+     * \brief Prints every recorded event on the debug port, one
+     * `cpu timestamp E|X function` line each
+     *
+     * Stops tracing and consumes the recorded events.
+     */
+    void dumpEvents();
+  }
+}
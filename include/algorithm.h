@@ -1,5 +1,9 @@
 #pragma once
 
+#include <stddef.h>
+#include <utility.h>
+#include <function_objects.h>
+
 namespace os {
   namespace std {
     template<class InputIt, class T>
@@ -93,5 +97,144 @@ namespace os {
       }
       return d_first;
     }
+    template<class ForwardIt, class T, class Compare>
+    ForwardIt lower_bound(ForwardIt first, ForwardIt last, const T& value, Compare comp) {
+      size_t count = last - first;
+      while(count > 0) {
+        size_t step = count / 2;
+        ForwardIt it = first + step;
+        if(comp(*it, value)) {
+          first = ++it;
+          count -= step + 1;
+        } else {
+          count = step;
+        }
+      }
+      return first;
+    }
+
+    template<class ForwardIt, class T>
+    ForwardIt lower_bound(ForwardIt first, ForwardIt last, const T& value) {
+      return std::lower_bound(first, last, value, std::less<T>());
+    }
+
+    template<class ForwardIt, class T, class Compare>
+    ForwardIt upper_bound(ForwardIt first, ForwardIt last, const T& value, Compare comp) {
+      size_t count = last - first;
+      while(count > 0) {
+        size_t step = count / 2;
+        ForwardIt it = first + step;
+        if(!comp(value, *it)) {
+          first = ++it;
+          count -= step + 1;
+        } else {
+          count = step;
+        }
+      }
+      return first;
+    }
+
+    template<class ForwardIt, class T>
+    ForwardIt upper_bound(ForwardIt first, ForwardIt last, const T& value) {
+      return std::upper_bound(first, last, value, std::less<T>());
+    }
+
+    namespace detail {
+      template<class RandomIt, class Compare>
+      void insertion_sort(RandomIt first, RandomIt last, Compare comp) {
+        if(first == last) return;
+        for(RandomIt i = first + 1; i != last; ++i) {
+          auto v = std::move(*i);
+          RandomIt j = i;
+          for(; j != first && comp(v, *(j - 1)); --j) {
+            *j = std::move(*(j - 1));
+          }
+          *j = std::move(v);
+        }
+      }
+
+      template<class RandomIt, class Compare>
+      void sift_down(RandomIt first, size_t i, size_t size, Compare comp) {
+        auto v = std::move(first[i]);
+        size_t child;
+        while((child = 2 * i + 1) < size) {
+          if(child + 1 < size && comp(first[child], first[child + 1])) child++;
+          if(!comp(v, first[child])) break;
+          first[i] = std::move(first[child]);
+          i = child;
+        }
+        first[i] = std::move(v);
+      }
+
+      template<class RandomIt, class Compare>
+      void heap_sort(RandomIt first, RandomIt last, Compare comp) {
+        size_t size = last - first;
+        for(size_t i = size / 2; i-- > 0;) {
+          sift_down(first, i, size, comp);
+        }
+        while(size > 1) {
+          size--;
+          std::swap(first[0], first[size]);
+          sift_down(first, 0, size, comp);
+        }
+      }
+
+      // Quicksort on a median of three pivot, falling back to heap sort when
+      // the recursion gets too deep, and leaving small ranges to a final
+      // insertion sort
+      template<class RandomIt, class Compare>
+      void intro_sort(RandomIt first, RandomIt last, size_t depth, Compare comp) {
+        while(last - first > 16) {
+          if(depth == 0) {
+            heap_sort(first, last, comp);
+            return;
+          }
+          depth--;
+
+          RandomIt mid = first + (last - first) / 2;
+          RandomIt back = last - 1;
+          if(comp(*mid, *first)) std::swap(*mid, *first);
+          if(comp(*back, *mid)) {
+            std::swap(*back, *mid);
+            if(comp(*mid, *first)) std::swap(*mid, *first);
+          }
+          auto pivot = *mid;
+
+          RandomIt lo = first;
+          RandomIt hi = last - 1;
+          while(true) {
+            while(comp(*lo, pivot)) ++lo;
+            while(comp(pivot, *hi)) --hi;
+            if(!(lo < hi)) break;
+            std::swap(*lo, *hi);
+            ++lo;
+            --hi;
+          }
+          RandomIt cut = lo;
+
+          // Recurse into the smaller half so the stack stays logarithmic
+          if(cut - first < last - cut) {
+            intro_sort(first, cut, depth, comp);
+            first = cut;
+          } else {
+            intro_sort(cut, last, depth, comp);
+            last = cut;
+          }
+        }
+      }
+    }
+
+    template<class RandomIt, class Compare>
+    void sort(RandomIt first, RandomIt last, Compare comp) {
+      size_t depth = 0;
+      for(size_t n = last - first; n > 1; n >>= 1) depth += 2;
+      detail::intro_sort(first, last, depth, comp);
+      detail::insertion_sort(first, last, comp);
+    }
+
+    template<class RandomIt>
+    void sort(RandomIt first, RandomIt last) {
+      std::sort(first, last, std::less<remove_cvref_t<decltype(*first)>>());
+    }
   }
 }
\ No newline at end of file
@@ -0,0 +1,134 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <kassert.h>
+#include <kallocator.h>
+
+namespace os {
+  // Bump-pointer allocator over a chain of kmalloc'd chunks, for groups of
+  // objects that all die together. Individual frees are no-ops, memory comes
+  // back all at once with reset() or when the arena is destroyed. Destructors
+  // of the objects are not run.
+  class Arena {
+  public:
+    // The heap works in pages and keeps a small header in front of each block
+    static constexpr size_t default_chunk_size = 0x1000 - 16;
+
+    explicit Arena(size_t chunkSize = default_chunk_size)
+        : m_chunkSize(chunkSize) {}
+
+    ~Arena() {
+      release();
+    }
+
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    void* allocate(size_t size, size_t align = alignof(uint64_t)) {
+      assert(align != 0 && (align & (align - 1)) == 0);
+
+      uintptr_t p = (m_pos + align - 1) & ~(align - 1);
+      if(m_current == nullptr || p + size > m_end) {
+        next_chunk(size + align - 1);
+        p = (m_pos + align - 1) & ~(align - 1);
+      }
+
+      m_pos = p + size;
+      return (void*)p;
+    }
+
+    template<typename T>
+    T* allocate_array(size_t n) {
+      if(n > (size_t)-1 / sizeof(T)) panic("Bad allocation");
+      return static_cast<T*>(allocate(n * sizeof(T), alignof(T)));
+    }
+
+    // Forgets every allocation but keeps the chunks for reuse
+    void reset() {
+      m_current = m_head;
+      if(m_current != nullptr) {
+        m_pos = m_current->begin();
+        m_end = m_current->end();
+      }
+    }
+
+    // Gives every chunk back to the heap
+    void release() {
+      Chunk* c = m_head;
+      while(c != nullptr) {
+        Chunk* next = c->next;
+        kfree(c);
+        c = next;
+      }
+      m_head = m_current = nullptr;
+      m_pos = m_end = 0;
+    }
+
+  private:
+    struct Chunk {
+      Chunk* next;
+      size_t size;
+
+      uintptr_t begin() const {
+        return (uintptr_t)(this + 1);
+      }
+
+      uintptr_t end() const {
+        return begin() + size;
+      }
+    };
+
+    // Moves on to a chunk with at least \p needed free bytes, reusing the
+    // chunks left over by reset() when they're big enough
+    void next_chunk(size_t needed) {
+      Chunk* c = m_current != nullptr ? m_current->next : m_head;
+      while(c != nullptr && c->size < needed) c = c->next;
+
+      if(c == nullptr) {
+        size_t size = needed > m_chunkSize - sizeof(Chunk) ? needed : m_chunkSize - sizeof(Chunk);
+        c = static_cast<Chunk*>(kmalloc(sizeof(Chunk) + size));
+        if(c == nullptr) panic("Out of memory for arena");
+        c->size = size;
+
+        // Insert after the current chunk, so that reset() finds it again
+        if(m_current == nullptr) {
+          c->next = m_head;
+          m_head = c;
+        } else {
+          c->next = m_current->next;
+          m_current->next = c;
+        }
+      }
+
+      m_current = c;
+      m_pos = c->begin();
+      m_end = c->end();
+    }
+
+    size_t m_chunkSize;
+    Chunk* m_head = nullptr;
+    Chunk* m_current = nullptr;
+    uintptr_t m_pos = 0;
+    uintptr_t m_end = 0;
+  };
+
+  // Allocator adapter for containers, deallocation does nothing
+  template <class T>
+  struct ArenaAllocator {
+    typedef T value_type;
+    ArenaAllocator(Arena& arena) noexcept : m_arena(&arena) {}
+    template <class U> constexpr ArenaAllocator(const ArenaAllocator<U>& other) noexcept
+        : m_arena(other.m_arena) {}
+    T* allocate(size_t n) {
+      return m_arena->allocate_array<T>(n);
+    }
+    void deallocate(T*, size_t) noexcept {}
+
+    Arena* m_arena;
+  };
+  template <class T, class U>
+  bool operator==(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) { return a.m_arena == b.m_arena; }
+  template <class T, class U>
+  bool operator!=(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) { return a.m_arena != b.m_arena; }
+}
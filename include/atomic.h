@@ -0,0 +1,92 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace os {
+  // Size of a cache line on every x86 we target, used to keep data written by
+  // different CPUs (or by interrupt handlers and tasks) on separate lines
+  constexpr size_t cache_line_size = 64;
+
+  namespace std {
+    enum memory_order : int {
+      memory_order_relaxed = __ATOMIC_RELAXED,
+      memory_order_consume = __ATOMIC_CONSUME,
+      memory_order_acquire = __ATOMIC_ACQUIRE,
+      memory_order_release = __ATOMIC_RELEASE,
+      memory_order_acq_rel = __ATOMIC_ACQ_REL,
+      memory_order_seq_cst = __ATOMIC_SEQ_CST
+    };
+
+    template<typename T>
+    class atomic {
+    public:
+      using value_type = T;
+
+      constexpr atomic() noexcept : m_value() {}
+      constexpr atomic(T v) noexcept : m_value(v) {}
+      atomic(const atomic&) = delete;
+      atomic& operator=(const atomic&) = delete;
+
+      T load(memory_order order = memory_order_seq_cst) const noexcept {
+        return __atomic_load_n(&m_value, order);
+      }
+
+      void store(T v, memory_order order = memory_order_seq_cst) noexcept {
+        __atomic_store_n(&m_value, v, order);
+      }
+
+      T exchange(T v, memory_order order = memory_order_seq_cst) noexcept {
+        return __atomic_exchange_n(&m_value, v, order);
+      }
+
+      bool compare_exchange_weak(T& expected, T desired,
+                                 memory_order success = memory_order_seq_cst,
+                                 memory_order failure = memory_order_seq_cst) noexcept {
+        return __atomic_compare_exchange_n(&m_value, &expected, desired, true, success, failure);
+      }
+
+      bool compare_exchange_strong(T& expected, T desired,
+                                   memory_order success = memory_order_seq_cst,
+                                   memory_order failure = memory_order_seq_cst) noexcept {
+        return __atomic_compare_exchange_n(&m_value, &expected, desired, false, success, failure);
+      }
+
+      T fetch_add(T v, memory_order order = memory_order_seq_cst) noexcept {
+        return __atomic_fetch_add(&m_value, v, order);
+      }
+
+      T fetch_sub(T v, memory_order order = memory_order_seq_cst) noexcept {
+        return __atomic_fetch_sub(&m_value, v, order);
+      }
+
+      T fetch_or(T v, memory_order order = memory_order_seq_cst) noexcept {
+        return __atomic_fetch_or(&m_value, v, order);
+      }
+
+      T fetch_and(T v, memory_order order = memory_order_seq_cst) noexcept {
+        return __atomic_fetch_and(&m_value, v, order);
+      }
+
+      operator T() const noexcept {
+        return load();
+      }
+
+      T operator=(T v) noexcept {
+        store(v);
+        return v;
+      }
+
+    private:
+      T m_value;
+    };
+
+    inline void atomic_thread_fence(memory_order order) noexcept {
+      __atomic_thread_fence(order);
+    }
+
+    inline void atomic_signal_fence(memory_order order) noexcept {
+      __atomic_signal_fence(order);
+    }
+  }
+}
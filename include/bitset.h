@@ -9,8 +9,8 @@ namespace os {
   template<typename T = uint32_t, typename Allocator = os::KernelAllocator<T>>
   class bitset {
   public:
-    bitset(size_t size) 
-        : m_alloc(Allocator())
+    bitset(size_t size, const Allocator& alloc = Allocator())
+        : m_alloc(alloc)
         , m_size(size)
         , m_numValues((size - 1) / (sizeof(T) * 8) + 1)
         , m_freeSlots(m_size)
@@ -20,6 +20,13 @@ namespace os {
       }
     }
 
+    ~bitset() {
+      m_alloc.deallocate(m_values, m_numValues);
+    }
+
+    bitset(const bitset&) = delete;
+    bitset& operator=(const bitset&) = delete;
+
     size_t size() const {
       return m_size;
     }
@@ -73,6 +80,30 @@ namespace os {
       return (T)-1;
     }
 
+    // Like freeSpan, but for runs of any length
+    size_t freeRun(size_t n) const {
+      constexpr size_t bits = sizeof(T) * 8;
+      if(n == 0 || m_freeSlots < n) return (size_t)-1;
+
+      size_t run = 0;
+      size_t i = 0;
+      while(i < m_size) {
+        // Skip full words while not in a run
+        if(run == 0 && i % bits == 0 && m_values[i / bits] == (T)-1) {
+          i += bits;
+          continue;
+        }
+
+        if(test(i)) {
+          run = 0;
+        } else if(++run == n) {
+          return i + 1 - n;
+        }
+        i++;
+      }
+      return (size_t)-1;
+    }
+
     void set(size_t i) {
       assert(i < m_size);
       size_t idx = i / (sizeof(T) * 8);
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <stdint.h>
+
+namespace os {
+  // 64 by 32 bit unsigned division. The kernel isn't linked against libgcc,
+  // so plain 64 bit divisions (which call __udivdi3) can't be used.
+  inline uint64_t div64(uint64_t dividend, uint32_t divisor, uint32_t* remainder = nullptr) {
+    uint32_t high = dividend >> 32;
+    uint32_t low = dividend & 0xFFFFFFFF;
+    uint32_t qhigh = high / divisor;
+    uint32_t rhigh = high % divisor;
+    uint32_t qlow, rem;
+    // rhigh < divisor, so the quotient fits in 32 bits and divl can't fault
+    asm("divl %4" : "=a"(qlow), "=d"(rem) : "a"(low), "d"(rhigh), "rm"(divisor));
+    if(remainder != nullptr) *remainder = rem;
+    return ((uint64_t)qhigh << 32) | qlow;
+  }
+}
@@ -0,0 +1,309 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <kassert.h>
+#include <kallocator.h>
+#include <new.h>
+#include <pair.h>
+#include <utility.h>
+#include <type_traits.h>
+#include <function_objects.h>
+
+namespace os {
+  // Open addressing hash map with Robin Hood probing. A metadata byte per
+  // slot holds the entry's distance from its home slot (0 means empty), and
+  // entries that are further from home take over slots from closer ones, so
+  // probe sequences stay short even when the table is nearly full. Erasing
+  // shifts the following entries back instead of leaving tombstones.
+  //
+  // The capacity is a power of two and the table grows at 7/8 load. Storage
+  // comes from Allocator as raw bytes, e.g. VirtualAllocator for big tables.
+  // Pointers to entries are invalidated by inserts and erases. A
+  // zero-initialized map is a valid empty one.
+  template<typename K, typename V,
+           typename Hash = std::hash<K>,
+           typename KeyEqual = std::equal_to<K>,
+           typename Allocator = os::KernelAllocator<uint8_t>>
+  class flat_hash_map {
+  public:
+    using key_type = K;
+    using mapped_type = V;
+    using value_type = std::pair<K, V>;
+    using size_type = size_t;
+
+    template<bool Const>
+    class basic_iterator {
+    public:
+      using map_type = std::conditional_t<Const, const flat_hash_map, flat_hash_map>;
+      using reference = std::conditional_t<Const, const value_type&, value_type&>;
+      using pointer = std::conditional_t<Const, const value_type*, value_type*>;
+
+      basic_iterator(map_type* map, size_t index) : m_map(map), m_index(index) {
+        skip_empty();
+      }
+
+      reference operator*() const {
+        return m_map->m_slots[m_index];
+      }
+
+      pointer operator->() const {
+        return &m_map->m_slots[m_index];
+      }
+
+      basic_iterator& operator++() {
+        m_index++;
+        skip_empty();
+        return *this;
+      }
+
+      bool operator==(const basic_iterator& other) const {
+        return m_index == other.m_index;
+      }
+
+      bool operator!=(const basic_iterator& other) const {
+        return m_index != other.m_index;
+      }
+
+    private:
+      void skip_empty() {
+        while(m_index < m_map->m_capacity && m_map->m_meta[m_index] == 0) m_index++;
+      }
+
+      map_type* m_map;
+      size_t m_index;
+    };
+
+    using iterator = basic_iterator<false>;
+    using const_iterator = basic_iterator<true>;
+
+    flat_hash_map()
+        : m_alloc(), m_meta(nullptr), m_slots(nullptr), m_size(0), m_capacity(0) {}
+
+    explicit flat_hash_map(const Allocator& alloc)
+        : m_alloc(alloc), m_meta(nullptr), m_slots(nullptr), m_size(0), m_capacity(0) {}
+
+    flat_hash_map(flat_hash_map&& other)
+        : m_alloc(other.m_alloc), m_meta(other.m_meta), m_slots(other.m_slots)
+        , m_size(other.m_size), m_capacity(other.m_capacity) {
+      other.m_meta = nullptr;
+      other.m_slots = nullptr;
+      other.m_size = 0;
+      other.m_capacity = 0;
+    }
+
+    flat_hash_map(const flat_hash_map&) = delete;
+    flat_hash_map& operator=(const flat_hash_map&) = delete;
+
+    ~flat_hash_map() {
+      clear();
+      release(m_meta, m_capacity);
+    }
+
+    iterator begin() { return iterator(this, 0); }
+    iterator end() { return iterator(this, m_capacity); }
+    const_iterator begin() const { return const_iterator(this, 0); }
+    const_iterator end() const { return const_iterator(this, m_capacity); }
+
+    size_t size() const {
+      return m_size;
+    }
+
+    bool empty() const {
+      return m_size == 0;
+    }
+
+    size_t capacity() const {
+      return m_capacity;
+    }
+
+    iterator find(const K& key) {
+      return iterator(this, lookup(key));
+    }
+
+    const_iterator find(const K& key) const {
+      return const_iterator(this, lookup(key));
+    }
+
+    bool contains(const K& key) const {
+      return lookup(key) != m_capacity;
+    }
+
+    // Returns the value for key, nullptr if not present
+    V* get(const K& key) {
+      size_t i = lookup(key);
+      return i == m_capacity ? nullptr : &m_slots[i].second;
+    }
+
+    const V* get(const K& key) const {
+      size_t i = lookup(key);
+      return i == m_capacity ? nullptr : &m_slots[i].second;
+    }
+
+    // Inserts key if not present. The bool is false if it already was, in
+    // which case the existing value is left untouched.
+    template<typename... Args>
+    std::pair<iterator, bool> emplace(const K& key, Args&&... args) {
+      size_t i = lookup(key);
+      if(i != m_capacity) return {iterator(this, i), false};
+
+      reserve(m_size + 1);
+      value_type entry{key, V(std::forward<Args>(args)...)};
+      i = place(std::move(entry), Hash()(key));
+      return {iterator(this, i), true};
+    }
+
+    std::pair<iterator, bool> insert(const K& key, const V& value) {
+      return emplace(key, value);
+    }
+
+    V& operator[](const K& key) {
+      return emplace(key).first->second;
+    }
+
+    bool erase(const K& key) {
+      size_t i = lookup(key);
+      if(i == m_capacity) return false;
+      erase_at(i);
+      return true;
+    }
+
+    void clear() {
+      for(size_t i = 0; i < m_capacity; i++) {
+        if(m_meta[i] != 0) {
+          m_slots[i].~value_type();
+          m_meta[i] = 0;
+        }
+      }
+      m_size = 0;
+    }
+
+    // Makes room for n entries without rehashing
+    void reserve(size_t n) {
+      size_t needed = m_capacity;
+      if(needed == 0) needed = min_capacity;
+      while(n > max_load(needed)) needed *= 2;
+      if(needed != m_capacity) rehash(needed);
+    }
+
+  private:
+    static constexpr size_t min_capacity = 8;
+    // Stored distances are 1-based in a byte, longer probes force a rehash
+    static constexpr uint8_t max_distance = 255;
+
+    static size_t max_load(size_t capacity) {
+      return capacity - capacity / 8;
+    }
+
+    size_t mask() const {
+      return m_capacity - 1;
+    }
+
+    // Index of key's slot, m_capacity if absent
+    size_t lookup(const K& key) const {
+      if(m_size == 0) return m_capacity;
+
+      size_t i = Hash()(key) & mask();
+      for(uint8_t dist = 1; ; dist++) {
+        // An entry closer to its home than we are to ours means key would
+        // have taken its place, had it been inserted
+        if(m_meta[i] < dist) return m_capacity;
+        if(m_meta[i] == dist && KeyEqual()(m_slots[i].first, key)) return i;
+        i = (i + 1) & mask();
+      }
+    }
+
+    // Inserts an entry known to be absent, returns where it ended up
+    size_t place(value_type&& entry, size_t hash) {
+      size_t i = hash & mask();
+      uint8_t dist = 1;
+      size_t result = m_capacity;
+
+      while(true) {
+        if(m_meta[i] == 0) {
+          new (&m_slots[i]) value_type(std::move(entry));
+          m_meta[i] = dist;
+          m_size++;
+          return result == m_capacity ? i : result;
+        }
+
+        if(m_meta[i] < dist) {
+          // Rob the richer entry, then go on placing it instead
+          std::swap(m_slots[i], entry);
+          uint8_t tmp = m_meta[i];
+          m_meta[i] = dist;
+          dist = tmp;
+          if(result == m_capacity) result = i;
+        }
+
+        i = (i + 1) & mask();
+        if(++dist == max_distance) {
+          // Pathological clustering, spread things out and start over
+          K key = result == m_capacity ? entry.first : m_slots[result].first;
+          rehash(m_capacity * 2);
+          size_t hash2 = Hash()(entry.first);
+          size_t pos = place(std::move(entry), hash2);
+          return result == m_capacity ? pos : lookup(key);
+        }
+      }
+    }
+
+    void erase_at(size_t i) {
+      m_slots[i].~value_type();
+      m_meta[i] = 0;
+      m_size--;
+
+      // Shift the following entries one slot closer to home
+      size_t next = (i + 1) & mask();
+      while(m_meta[next] > 1) {
+        new (&m_slots[i]) value_type(std::move(m_slots[next]));
+        m_slots[next].~value_type();
+        m_meta[i] = m_meta[next] - 1;
+        m_meta[next] = 0;
+        i = next;
+        next = (next + 1) & mask();
+      }
+    }
+
+    void rehash(size_t capacity) {
+      uint8_t* oldMeta = m_meta;
+      value_type* oldSlots = m_slots;
+      size_t oldCapacity = m_capacity;
+
+      allocate(capacity);
+      m_size = 0;
+      for(size_t i = 0; i < oldCapacity; i++) {
+        if(oldMeta[i] != 0) {
+          place(std::move(oldSlots[i]), Hash()(oldSlots[i].first));
+          oldSlots[i].~value_type();
+        }
+      }
+      release(oldMeta, oldCapacity);
+    }
+
+    // Metadata and slots share one allocation, slots first for alignment
+    static size_t slots_bytes(size_t capacity) {
+      size_t bytes = capacity * sizeof(value_type);
+      return (bytes + alignof(value_type) - 1) & ~(alignof(value_type) - 1);
+    }
+
+    void allocate(size_t capacity) {
+      uint8_t* block = m_alloc.allocate(slots_bytes(capacity) + capacity);
+      m_slots = reinterpret_cast<value_type*>(block);
+      m_meta = block + slots_bytes(capacity);
+      for(size_t i = 0; i < capacity; i++) m_meta[i] = 0;
+      m_capacity = capacity;
+    }
+
+    void release(uint8_t* meta, size_t capacity) {
+      if(meta == nullptr) return;
+      m_alloc.deallocate(meta - slots_bytes(capacity), slots_bytes(capacity) + capacity);
+    }
+
+    Allocator m_alloc;
+    uint8_t* m_meta;
+    value_type* m_slots;
+    size_t m_size;
+    size_t m_capacity;
+  };
+}
@@ -0,0 +1,153 @@
+#pragma once
+
+#include <stddef.h>
+#include <new.h>
+#include <type_traits.h>
+#include <utility.h>
+#include <kassert.h>
+
+namespace os {
+  namespace std {
+    template<typename Signature>
+    class function_ref;
+
+    // Non-owning reference to a callable, the referenced object must outlive it
+    template<typename R, typename... Args>
+    class function_ref<R(Args...)> {
+    public:
+      function_ref(R (*fn)(Args...))
+          : m_object((void*)fn)
+          , m_invoke([](void* obj, Args... args) -> R {
+              return reinterpret_cast<R (*)(Args...)>(obj)(std::forward<Args>(args)...);
+            }) {}
+
+      template<typename F,
+               typename = enable_if_t<!is_same<remove_cvref_t<F>, function_ref>::value>>
+      function_ref(F&& f)
+          : m_object((void*)&f)
+          , m_invoke([](void* obj, Args... args) -> R {
+              return (*static_cast<remove_reference_t<F>*>(obj))(std::forward<Args>(args)...);
+            }) {}
+
+      R operator()(Args... args) const {
+        return m_invoke(m_object, std::forward<Args>(args)...);
+      }
+
+    private:
+      void* m_object;
+      R (*m_invoke)(void*, Args...);
+    };
+  }
+
+  template<typename Signature, size_t Capacity = 4 * sizeof(void*)>
+  class inplace_function;
+
+  // Owning callable wrapper that keeps the callable in an inline buffer of
+  // Capacity bytes and never allocates
+  template<typename R, typename... Args, size_t Capacity>
+  class inplace_function<R(Args...), Capacity> {
+  public:
+    inplace_function()
+        : m_invoke(nullptr)
+        , m_manage(nullptr) {}
+
+    inplace_function(R (*fn)(Args...))
+        : inplace_function() {
+      if(fn != nullptr) emplace<R (*)(Args...)>(fn);
+    }
+
+    template<typename F,
+             typename = std::enable_if_t<!std::is_same<std::remove_cvref_t<F>, inplace_function>::value>>
+    inplace_function(F&& f)
+        : inplace_function() {
+      emplace<std::remove_cvref_t<F>>(std::forward<F>(f));
+    }
+
+    inplace_function(const inplace_function& f)
+        : m_invoke(f.m_invoke)
+        , m_manage(f.m_manage) {
+      if(m_manage) m_manage(Operation::Copy, &m_storage, (void*)&f.m_storage);
+    }
+
+    inplace_function(inplace_function&& f)
+        : m_invoke(f.m_invoke)
+        , m_manage(f.m_manage) {
+      if(m_manage) m_manage(Operation::Move, &m_storage, &f.m_storage);
+    }
+
+    ~inplace_function() {
+      reset();
+    }
+
+    inplace_function& operator=(const inplace_function& f) {
+      if(this != &f) {
+        reset();
+        m_invoke = f.m_invoke;
+        m_manage = f.m_manage;
+        if(m_manage) m_manage(Operation::Copy, &m_storage, (void*)&f.m_storage);
+      }
+      return *this;
+    }
+
+    inplace_function& operator=(inplace_function&& f) {
+      if(this != &f) {
+        reset();
+        m_invoke = f.m_invoke;
+        m_manage = f.m_manage;
+        if(m_manage) m_manage(Operation::Move, &m_storage, &f.m_storage);
+      }
+      return *this;
+    }
+
+    R operator()(Args... args) const {
+      assert(m_invoke != nullptr);
+      return m_invoke((void*)&m_storage, std::forward<Args>(args)...);
+    }
+
+    explicit operator bool() const {
+      return m_invoke != nullptr;
+    }
+
+    void reset() {
+      if(m_manage) m_manage(Operation::Destroy, &m_storage, nullptr);
+      m_invoke = nullptr;
+      m_manage = nullptr;
+    }
+
+  private:
+    enum class Operation {
+      Copy,
+      Move,
+      Destroy
+    };
+
+    template<typename F, typename A>
+    void emplace(A&& f) {
+      static_assert(sizeof(F) <= Capacity, "Callable too large for inplace_function");
+      static_assert(alignof(F) <= alignof(Storage), "Callable alignment too large for inplace_function");
+
+      new (&m_storage) F(std::forward<A>(f));
+      m_invoke = [](void* obj, Args... args) -> R {
+        return (*static_cast<F*>(obj))(std::forward<Args>(args)...);
+      };
+      m_manage = [](Operation op, void* dst, void* src) {
+        switch(op) {
+          case Operation::Copy:
+            new (dst) F(*static_cast<const F*>(src)); break;
+          case Operation::Move:
+            new (dst) F(std::move(*static_cast<F*>(src))); break;
+          case Operation::Destroy:
+            static_cast<F*>(dst)->~F(); break;
+        }
+      };
+    }
+
+    struct alignas(8) Storage {
+      unsigned char bytes[Capacity];
+    };
+
+    Storage m_storage;
+    R (*m_invoke)(void*, Args...);
+    void (*m_manage)(Operation, void*, void*);
+  };
+}
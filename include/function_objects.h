@@ -1,5 +1,8 @@
 #pragma once
 
+#include <stddef.h>
+#include <stdint.h>
+
 namespace os {
   namespace std {
 
@@ -131,7 +134,77 @@ namespace os {
     
     template<typename T>
     struct hash {
-      size_t operator()(const T &x);
+      size_t operator()(const T &x) const;
+    };
+
+    namespace detail {
+      // Murmur3's finalizer: every input bit affects every output bit, so
+      // tables indexed by the low bits of the hash still spread well
+      constexpr uint32_t mix32(uint32_t h) {
+        h ^= h >> 16;
+        h *= 0x85EBCA6B;
+        h ^= h >> 13;
+        h *= 0xC2B2AE35;
+        h ^= h >> 16;
+        return h;
+      }
+
+      constexpr uint32_t mix64(uint64_t h) {
+        return mix32((uint32_t)h ^ mix32((uint32_t)(h >> 32)));
+      }
+    }
+
+#define OS_INTEGER_HASH(T, MIX) \
+    template<> \
+    struct hash<T> { \
+      constexpr size_t operator()(T x) const { \
+        return detail::MIX(x); \
+      } \
+    };
+
+    OS_INTEGER_HASH(bool, mix32)
+    OS_INTEGER_HASH(char, mix32)
+    OS_INTEGER_HASH(signed char, mix32)
+    OS_INTEGER_HASH(unsigned char, mix32)
+    OS_INTEGER_HASH(short, mix32)
+    OS_INTEGER_HASH(unsigned short, mix32)
+    OS_INTEGER_HASH(int, mix32)
+    OS_INTEGER_HASH(unsigned int, mix32)
+    OS_INTEGER_HASH(long, mix32)
+    OS_INTEGER_HASH(unsigned long, mix32)
+    OS_INTEGER_HASH(long long, mix64)
+    OS_INTEGER_HASH(unsigned long long, mix64)
+
+#undef OS_INTEGER_HASH
+
+    // Hashes the address, not what it points to
+    template<typename T>
+    struct hash<T*> {
+      size_t operator()(T* p) const {
+        return detail::mix32((uintptr_t)p);
+      }
+    };
+
+    // Hash and equality of NUL terminated strings by content (FNV-1a)
+    struct cstring_hash {
+      size_t operator()(const char* s) const {
+        uint32_t h = 2166136261u;
+        while(*s) {
+          h ^= (uint8_t)*s++;
+          h *= 16777619u;
+        }
+        return detail::mix32(h);
+      }
+    };
+
+    struct cstring_equal_to {
+      bool operator()(const char* a, const char* b) const {
+        while(*a && *a == *b) {
+          a++;
+          b++;
+        }
+        return *a == *b;
+      }
     };
 
   }
@@ -0,0 +1,164 @@
+#pragma once
+
+#include <stddef.h>
+#include <kassert.h>
+#include <function_objects.h>
+#include <refcount.h>
+#include <type_traits.h>
+
+namespace os {
+  // Base for types that carry their own reference count, for use with
+  // intrusive_ptr. Objects are destroyed with delete when the count drops
+  // to zero, so they must be allocated with new.
+  template<typename Derived>
+  class RefCounted {
+  public:
+    size_t use_count() const {
+      return m_refcount.count();
+    }
+
+  protected:
+    RefCounted() = default;
+    ~RefCounted() = default;
+
+  private:
+    mutable RefCount m_refcount;
+
+    friend void intrusive_ptr_add_ref(const Derived* p) {
+      p->m_refcount.increment();
+    }
+
+    friend void intrusive_ptr_release(const Derived* p) {
+      if(p->m_refcount.decrement()) {
+        delete p;
+      }
+    }
+
+    friend bool intrusive_ptr_try_add_ref(const Derived* p) {
+      return p->m_refcount.try_increment();
+    }
+  };
+
+  // Smart pointer to an object that counts its own references. No control
+  // block is allocated and a raw pointer can be turned back into an owning one.
+  template<typename T>
+  class intrusive_ptr {
+  public:
+    using nullptr_t = decltype(nullptr);
+
+    intrusive_ptr() : m_ptr(nullptr) {}
+    intrusive_ptr(nullptr_t) : m_ptr(nullptr) {}
+    intrusive_ptr(T* ptr) : m_ptr(ptr) {
+      if(m_ptr != nullptr) intrusive_ptr_add_ref(m_ptr);
+    }
+
+    // With add_ref false, takes over a reference the caller already holds
+    intrusive_ptr(T* ptr, bool add_ref) : m_ptr(ptr) {
+      if(m_ptr != nullptr && add_ref) intrusive_ptr_add_ref(m_ptr);
+    }
+
+    intrusive_ptr(const intrusive_ptr& p) : m_ptr(p.m_ptr) {
+      if(m_ptr != nullptr) intrusive_ptr_add_ref(m_ptr);
+    }
+
+    intrusive_ptr(intrusive_ptr&& p) : m_ptr(p.m_ptr) {
+      p.m_ptr = nullptr;
+    }
+
+    ~intrusive_ptr() {
+      if(m_ptr != nullptr) intrusive_ptr_release(m_ptr);
+    }
+
+    intrusive_ptr& operator=(const intrusive_ptr& p) {
+      intrusive_ptr(p).swap(*this);
+      return *this;
+    }
+
+    intrusive_ptr& operator=(intrusive_ptr&& p) {
+      intrusive_ptr(static_cast<intrusive_ptr&&>(p)).swap(*this);
+      return *this;
+    }
+
+    intrusive_ptr& operator=(T* p) {
+      intrusive_ptr(p).swap(*this);
+      return *this;
+    }
+
+    void swap(intrusive_ptr& other) {
+      T* tmp = m_ptr;
+      m_ptr = other.m_ptr;
+      other.m_ptr = tmp;
+    }
+
+    T* get() const {
+      return m_ptr;
+    }
+
+    T& operator*() const {
+      assert(m_ptr != nullptr);
+      return *m_ptr;
+    }
+
+    T* operator->() const {
+      assert(m_ptr != nullptr);
+      return m_ptr;
+    }
+
+    size_t use_count() const {
+      if(m_ptr == nullptr) return 0;
+      return m_ptr->use_count();
+    }
+
+    explicit operator bool() const {
+      return m_ptr != nullptr;
+    }
+
+  private:
+    T* m_ptr;
+  };
+
+  namespace std {
+    template<typename T>
+    struct is_trivially_relocatable<intrusive_ptr<T>> : true_type {};
+  }
+
+  template<typename T, typename U>
+  bool operator==(const intrusive_ptr<T>& lhs, const intrusive_ptr<U>& rhs) {
+    return lhs.get() == rhs.get();
+  }
+
+  template<typename T>
+  bool operator==(const intrusive_ptr<T>& lhs, decltype(nullptr)) {
+    return !lhs;
+  }
+
+  template<typename T, typename U>
+  bool operator!=(const intrusive_ptr<T>& lhs, const intrusive_ptr<U>& rhs) {
+    return !(lhs == rhs);
+  }
+
+  template<typename T>
+  bool operator!=(const intrusive_ptr<T>& lhs, decltype(nullptr)) {
+    return static_cast<bool>(lhs);
+  }
+
+  template<typename T>
+  bool operator<(const intrusive_ptr<T>& lhs, const intrusive_ptr<T>& rhs) {
+    return std::less<T*>()(lhs.get(), rhs.get());
+  }
+
+  template<typename T>
+  bool operator<=(const intrusive_ptr<T>& lhs, const intrusive_ptr<T>& rhs) {
+    return std::less_equal<T*>()(lhs.get(), rhs.get());
+  }
+
+  template<typename T>
+  bool operator>(const intrusive_ptr<T>& lhs, const intrusive_ptr<T>& rhs) {
+    return std::greater<T*>()(lhs.get(), rhs.get());
+  }
+
+  template<typename T>
+  bool operator>=(const intrusive_ptr<T>& lhs, const intrusive_ptr<T>& rhs) {
+    return std::greater_equal<T*>()(lhs.get(), rhs.get());
+  }
+}
@@ -0,0 +1,9 @@
+#pragma once
+
+#include <stddef.h>
+
+// Placement new, normally provided by <new>
+inline void* operator new(size_t, void* p) noexcept { return p; }
+inline void* operator new[](size_t, void* p) noexcept { return p; }
+inline void operator delete(void*, void*) noexcept {}
+inline void operator delete[](void*, void*) noexcept {}
@@ -0,0 +1,185 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <new.h>
+#include <utility.h>
+#include <atomic.h>
+#include <percpu.h>
+#include <kassert.h>
+#include "../kheap.h"
+#include "../synchro.h"
+
+namespace os {
+  // Constant time allocator for objects of a single type. Storage comes from
+  // heap chunks carved into equally sized slots, freed slots go on a free
+  // list and are reused, so there's neither per-object header nor
+  // fragmentation. Chunks are never given back to the heap.
+  //
+  // Each CPU keeps a few free slots of its own, moved from and to the shared
+  // list in batches, so most allocations take no lock. CacheAligned pads
+  // every slot to a cache line, for objects written by different CPUs.
+  //
+  // Pools are usable as globals without running constructors: the zero
+  // initialized state is an empty pool.
+  template<typename T, bool CacheAligned = false>
+  class ObjectPool {
+  public:
+    ObjectPool() = default;
+
+    ObjectPool(const ObjectPool&) = delete;
+    ObjectPool& operator=(const ObjectPool&) = delete;
+
+    // The pool shared by every user of T
+    static ObjectPool& instance() {
+      return s_instance;
+    }
+
+    // Returns uninitialized storage for one T
+    T* allocate() {
+      InterruptGuard guard;
+      LocalCache& cache = m_caches.local();
+      if(cache.head == nullptr) refill(cache);
+
+      Slot* s = cache.head;
+      cache.head = s->next;
+      cache.count--;
+      return reinterpret_cast<T*>(s);
+    }
+
+    void deallocate(T* p) {
+      if(p == nullptr) return;
+
+      InterruptGuard guard;
+      LocalCache& cache = m_caches.local();
+      Slot* s = reinterpret_cast<Slot*>(p);
+      s->next = cache.head;
+      cache.head = s;
+      cache.count++;
+      if(cache.count >= 2 * batch_size) drain(cache);
+    }
+
+    template<typename... Args>
+    T* create(Args&&... args) {
+      return new (allocate()) T(std::forward<Args>(args)...);
+    }
+
+    void destroy(T* p) {
+      if(p == nullptr) return;
+      p->~T();
+      deallocate(p);
+    }
+
+  private:
+    static constexpr size_t slot_align_min = alignof(T) > alignof(void*) ? alignof(T) : alignof(void*);
+    static constexpr size_t slot_align = CacheAligned && slot_align_min < cache_line_size
+      ? cache_line_size : slot_align_min;
+    static constexpr size_t slot_size_min = sizeof(T) > sizeof(void*) ? sizeof(T) : sizeof(void*);
+    static constexpr size_t slot_size = (slot_size_min + slot_align - 1) & ~(slot_align - 1);
+
+    // Sized so that a chunk and the heap's header fit in one page for small T
+    static constexpr size_t chunk_bytes = 0x1000 - 16;
+    static constexpr size_t chunk_slots_min = 8;
+
+    // Slots moved between a CPU and the shared list at once
+    static constexpr size_t batch_size = 16;
+
+    union Slot {
+      Slot* next;
+      alignas(slot_align) uint8_t storage[slot_size];
+    };
+
+    struct Chunk {
+      Chunk* next;
+    };
+
+    struct LocalCache {
+      Slot* head;
+      size_t count;
+    };
+
+    // Takes a batch from the shared list, carving a new chunk if needed
+    void refill(LocalCache& cache) {
+      scoped_lock<IrqSpinlock> l(m_lock);
+      if(m_free == nullptr) grow();
+
+      while(m_free != nullptr && cache.count < batch_size) {
+        Slot* s = m_free;
+        m_free = s->next;
+        s->next = cache.head;
+        cache.head = s;
+        cache.count++;
+      }
+    }
+
+    // Gives half of the CPU's slots back to the shared list
+    void drain(LocalCache& cache) {
+      scoped_lock<IrqSpinlock> l(m_lock);
+      while(cache.count > batch_size) {
+        Slot* s = cache.head;
+        cache.head = s->next;
+        cache.count--;
+        s->next = m_free;
+        m_free = s;
+      }
+    }
+
+    // Must be called with m_lock held
+    void grow() {
+      size_t bytes = chunk_bytes;
+      if(bytes < sizeof(Chunk) + slot_align + chunk_slots_min * slot_size) {
+        bytes = sizeof(Chunk) + slot_align + chunk_slots_min * slot_size;
+      }
+
+      Chunk* chunk = static_cast<Chunk*>(kmalloc(bytes));
+      if(chunk == nullptr) panic("Out of memory for object pool");
+      chunk->next = m_chunks;
+      m_chunks = chunk;
+
+      uintptr_t first = ((uintptr_t)(chunk + 1) + slot_align - 1) & ~(slot_align - 1);
+      uintptr_t end = (uintptr_t)chunk + bytes;
+      for(uintptr_t p = first; p + slot_size <= end; p += slot_size) {
+        Slot* s = reinterpret_cast<Slot*>(p);
+        s->next = m_free;
+        m_free = s;
+      }
+    }
+
+    PerCpu<LocalCache> m_caches;
+    IrqSpinlock m_lock;
+    Slot* m_free = nullptr;
+    Chunk* m_chunks = nullptr;
+
+    static ObjectPool s_instance;
+  };
+
+  template<typename T, bool CacheAligned>
+  ObjectPool<T, CacheAligned> ObjectPool<T, CacheAligned>::s_instance;
+
+  // Allocator interface over ObjectPool<T>::instance(). Single objects come
+  // from the pool, arrays fall back to the heap.
+  template <class T>
+  struct PoolAllocator {
+    typedef T value_type;
+    PoolAllocator() = default;
+    template <class U> constexpr PoolAllocator(const PoolAllocator<U>&) noexcept {}
+    T* allocate(size_t n) {
+      if(n == 1) return ObjectPool<T>::instance().allocate();
+      if(n > (size_t)-1 / sizeof(T)) panic("Bad allocation");
+      if(auto p = static_cast<T*>(kmalloc(n*sizeof(T)))) return p;
+      panic("Bad allocation");
+      return nullptr;
+    }
+    void deallocate(T* p, size_t n) noexcept {
+      if(n == 1) {
+        ObjectPool<T>::instance().deallocate(p);
+      } else {
+        kfree(p);
+      }
+    }
+  };
+  template <class T, class U>
+  bool operator==(const PoolAllocator<T>&, const PoolAllocator<U>&) { return true; }
+  template <class T, class U>
+  bool operator!=(const PoolAllocator<T>&, const PoolAllocator<U>&) { return false; }
+}
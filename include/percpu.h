@@ -0,0 +1,49 @@
+#pragma once
+
+#include <stddef.h>
+#include <atomic.h>
+
+#ifndef CONFIG_MAX_CPUS
+#define CONFIG_MAX_CPUS 1
+#endif
+
+namespace os {
+  constexpr size_t max_cpus = CONFIG_MAX_CPUS;
+
+  // Only the bootstrap processor runs for now
+  inline size_t current_cpu() {
+    return 0;
+  }
+
+  // One instance of T per CPU, each on its own cache line(s)
+  template<typename T>
+  class PerCpu {
+  public:
+    T& local() {
+      return m_slots[current_cpu()].value;
+    }
+
+    const T& local() const {
+      return m_slots[current_cpu()].value;
+    }
+
+    T& operator[](size_t cpu) {
+      return m_slots[cpu].value;
+    }
+
+    const T& operator[](size_t cpu) const {
+      return m_slots[cpu].value;
+    }
+
+    static constexpr size_t size() {
+      return max_cpus;
+    }
+
+  private:
+    struct alignas(cache_line_size) Slot {
+      T value;
+    };
+
+    Slot m_slots[max_cpus];
+  };
+}
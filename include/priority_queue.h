@@ -1,10 +1,75 @@
 #pragma once
 
+#include <stddef.h>
+#include <kassert.h>
 #include <vector.h>
+#include <utility.h>
 #include <function_objects.h>
 
 namespace os {
+  namespace detail {
+    // 4-ary heaps are shallower than binary ones, and the four children of a
+    // node are adjacent in memory, which more than pays for the extra
+    // comparisons. Elements are shifted with moves into a hole instead of
+    // being swapped. OnMove(elem, index) is told where every element lands.
+    constexpr size_t heap_arity = 4;
+
+    inline size_t heap_parent(size_t i) {
+      return (i - 1) / heap_arity;
+    }
+
+    inline size_t heap_first_child(size_t i) {
+      return i * heap_arity + 1;
+    }
+
+    template<typename Container, typename Compare, typename OnMove>
+    size_t heap_sift_up(Container& c, size_t i, OnMove onMove) {
+      auto v = std::move(c[i]);
+      while(i > 0) {
+        size_t parent = heap_parent(i);
+        if(!Compare()(v, c[parent])) break;
+        c[i] = std::move(c[parent]);
+        onMove(c[i], i);
+        i = parent;
+      }
+      c[i] = std::move(v);
+      onMove(c[i], i);
+      return i;
+    }
+
+    template<typename Container, typename Compare, typename OnMove>
+    size_t heap_sift_down(Container& c, size_t i, OnMove onMove) {
+      size_t size = c.size();
+      auto v = std::move(c[i]);
+      while(true) {
+        size_t first = heap_first_child(i);
+        if(first >= size) break;
+
+        size_t last = first + heap_arity < size ? first + heap_arity : size;
+        size_t best = first;
+        for(size_t child = first + 1; child < last; child++) {
+          if(Compare()(c[child], c[best])) best = child;
+        }
+
+        if(!Compare()(c[best], v)) break;
+        c[i] = std::move(c[best]);
+        onMove(c[i], i);
+        i = best;
+      }
+      c[i] = std::move(v);
+      onMove(c[i], i);
+      return i;
+    }
+
+    struct heap_no_index {
+      template<typename T>
+      void operator()(const T&, size_t) const {}
+    };
+  }
+
   namespace std {
+    // The element for which Compare is true against all others is on top,
+    // i.e. the smallest one with the default std::less
     template<typename T,
             typename Container = vector<T>,
             typename Compare = std::less<typename Container::value_type>>
@@ -24,15 +89,30 @@ namespace os {
         return m_container.front();
       }
 
-      void push(const_reference v) {
+      void push(const value_type& v) {
         m_container.push_back(v);
-        bubble_up(m_container.size());
+        sift_up(m_container.size() - 1);
+      }
+
+      void push(value_type&& v) {
+        m_container.push_back(std::move(v));
+        sift_up(m_container.size() - 1);
+      }
+
+      template<typename... Args>
+      void emplace(Args&&... args) {
+        m_container.emplace_back(std::forward<Args>(args)...);
+        sift_up(m_container.size() - 1);
       }
 
       void pop() {
-        m_container[0] = m_container.back();
-        m_container.pop_back();
-        heapify(1);
+        if(m_container.size() > 1) {
+          m_container.front() = std::move(m_container.back());
+          m_container.pop_back();
+          os::detail::heap_sift_down<Container, Compare>(m_container, 0, os::detail::heap_no_index());
+        } else {
+          m_container.pop_back();
+        }
       }
 
       size_t size() const {
@@ -46,38 +126,106 @@ namespace os {
     private:
       Container m_container;
 
-      void heapify(size_t i) {
-        size_t l = i * 2;
-        size_t r = i * 2 + 1;
-        size_t largest;
-        if(l <= size() && Compare()(m_container[l - 1], m_container[i - 1])) {
-          largest = l;
-        } else {
-          largest = i;
-        }
+      void sift_up(size_t i) {
+        os::detail::heap_sift_up<Container, Compare>(m_container, i, os::detail::heap_no_index());
+      }
+    };
+  }
 
-        if(r <= size() && Compare()(m_container[r - 1], m_container[largest - 1])) {
-          largest = r;
-        }
+  // Priority queue whose elements know their position in the heap, so that
+  // any of them can be removed or re-sorted after its priority changed in
+  // O(log n). IndexOf()(v) returns a size_t& stored with the element (e.g. a
+  // member of the object a pointer refers to), holding npos when not queued.
+  template<typename T, typename IndexOf,
+           typename Compare = std::less<T>,
+           typename Container = std::vector<T>>
+  class indexed_priority_queue {
+  public:
+    using value_type = T;
+    using size_type = size_t;
 
-        if(largest != i) {
-          auto tmp = m_container[i - 1];
-          m_container[i - 1] = m_container[largest - 1];
-          m_container[largest - 1] = tmp;
-          heapify(largest);
-        }
-      }
+    static constexpr size_t npos = (size_t)-1;
 
-      void bubble_up(size_t i) {
-        size_t parent = i / 2;
-        while(i > 1 && Compare()(m_container[i - 1], m_container[parent - 1])) {
-          auto tmp = m_container[i - 1];
-          m_container[i - 1] = m_container[parent - 1];
-          m_container[parent - 1] = tmp;
-          i = parent;
-          parent = i / 2;
-        }
+    const T& top() const {
+      return m_container.front();
+    }
+
+    // Whether v is queued, assuming its index isn't shared with another queue
+    bool contains(const T& v) const {
+      return IndexOf()(v) != npos;
+    }
+
+    void push(const T& v) {
+      assert(IndexOf()(v) == npos);
+      m_container.push_back(v);
+      sift_up(m_container.size() - 1);
+    }
+
+    void push(T&& v) {
+      assert(IndexOf()(v) == npos);
+      m_container.push_back(std::move(v));
+      sift_up(m_container.size() - 1);
+    }
+
+    template<typename... Args>
+    void emplace(Args&&... args) {
+      m_container.emplace_back(std::forward<Args>(args)...);
+      sift_up(m_container.size() - 1);
+    }
+
+    void pop() {
+      erase_at(0);
+    }
+
+    // Restores the order after v's priority changed
+    void update(const T& v) {
+      size_t i = IndexOf()(v);
+      assert(i < m_container.size());
+      if(sift_up(i) == i) sift_down(i);
+    }
+
+    void erase(const T& v) {
+      size_t i = IndexOf()(v);
+      assert(i < m_container.size());
+      erase_at(i);
+    }
+
+    size_t size() const {
+      return m_container.size();
+    }
+
+    bool empty() const {
+      return m_container.empty();
+    }
+
+  private:
+    struct SetIndex {
+      void operator()(const T& v, size_t i) const {
+        IndexOf()(v) = i;
       }
     };
-  }
-}
\ No newline at end of file
+
+    size_t sift_up(size_t i) {
+      return detail::heap_sift_up<Container, Compare>(m_container, i, SetIndex());
+    }
+
+    size_t sift_down(size_t i) {
+      return detail::heap_sift_down<Container, Compare>(m_container, i, SetIndex());
+    }
+
+    void erase_at(size_t i) {
+      IndexOf()(m_container[i]) = npos;
+
+      size_t last = m_container.size() - 1;
+      if(i != last) {
+        m_container[i] = std::move(m_container.back());
+        m_container.pop_back();
+        if(sift_up(i) == i) sift_down(i);
+      } else {
+        m_container.pop_back();
+      }
+    }
+
+    Container m_container;
+  };
+}
@@ -0,0 +1,454 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <kassert.h>
+#include <function_objects.h>
+
+namespace os {
+  // Link embedded in the objects kept in an RbTree, one per tree the object
+  // can be in. The tree never allocates.
+  struct RbNode {
+    RbNode* parent = nullptr;
+    RbNode* left = nullptr;
+    RbNode* right = nullptr;
+    bool red = false;
+  };
+
+  // Augment hook that does nothing. Augments have a static update(T&) that
+  // recomputes the node's cached data from its own value and its children's.
+  struct RbNoAugment {
+    template<typename T>
+    static void update(T&) {}
+  };
+
+  // Intrusive red-black tree of T ordered by KeyOf()(const T&), where KeyOf
+  // defines key_type. Equal keys are allowed and kept in insertion order.
+  // Node is the member holding the links, e.g. &Timer::node.
+  template<typename T, RbNode T::*Node, typename KeyOf,
+           typename Compare = std::less<typename KeyOf::key_type>,
+           typename Augment = RbNoAugment>
+  class RbTree {
+  public:
+    using key_type = typename KeyOf::key_type;
+    using value_type = T;
+
+    class iterator {
+    public:
+      iterator(RbNode* n) : m_node(n) {}
+
+      T& operator*() const { return *owner(m_node); }
+      T* operator->() const { return owner(m_node); }
+
+      iterator& operator++() {
+        m_node = successor(m_node);
+        return *this;
+      }
+
+      bool operator==(const iterator& other) const { return m_node == other.m_node; }
+      bool operator!=(const iterator& other) const { return m_node != other.m_node; }
+
+    private:
+      RbNode* m_node;
+    };
+
+    RbTree() = default;
+    RbTree(const RbTree&) = delete;
+    RbTree& operator=(const RbTree&) = delete;
+
+    bool empty() const { return m_root == nullptr; }
+    size_t size() const { return m_size; }
+
+    iterator begin() const { return iterator(m_root ? leftmost(m_root) : nullptr); }
+    iterator end() const { return iterator(nullptr); }
+
+    T* first() const { return m_root ? owner(leftmost(m_root)) : nullptr; }
+    T* last() const { return m_root ? owner(rightmost(m_root)) : nullptr; }
+    T* root() const { return m_root ? owner(m_root) : nullptr; }
+
+    static T* next(T& v) {
+      RbNode* n = successor(&(v.*Node));
+      return n ? owner(n) : nullptr;
+    }
+
+    static T* prev(T& v) {
+      RbNode* n = predecessor(&(v.*Node));
+      return n ? owner(n) : nullptr;
+    }
+
+    // Children, for walking the tree in augmented queries
+    static T* left(const T& v) { return (v.*Node).left ? owner((v.*Node).left) : nullptr; }
+    static T* right(const T& v) { return (v.*Node).right ? owner((v.*Node).right) : nullptr; }
+
+    void insert(T& v) {
+      RbNode* n = &(v.*Node);
+      const key_type& key = KeyOf()(v);
+
+      RbNode* parent = nullptr;
+      RbNode** link = &m_root;
+      while(*link != nullptr) {
+        parent = *link;
+        if(Compare()(key, KeyOf()(*owner(parent)))) {
+          link = &parent->left;
+        } else {
+          link = &parent->right;
+        }
+      }
+
+      n->parent = parent;
+      n->left = n->right = nullptr;
+      n->red = true;
+      *link = n;
+      m_size++;
+
+      propagate(n);
+      insert_fixup(n);
+    }
+
+    void erase(T& v) {
+      RbNode* z = &(v.*Node);
+      RbNode* x;         // Node that moved into the removed position
+      RbNode* xParent;   // Its parent, as x may be null
+      bool removedRed;
+
+      if(z->left == nullptr || z->right == nullptr) {
+        x = z->left ? z->left : z->right;
+        xParent = z->parent;
+        removedRed = z->red;
+        transplant(z, x);
+      } else {
+        // Replace z by its successor y, which has no left child
+        RbNode* y = leftmost(z->right);
+        removedRed = y->red;
+        x = y->right;
+        if(y->parent == z) {
+          xParent = y;
+        } else {
+          xParent = y->parent;
+          transplant(y, x);
+          y->right = z->right;
+          y->right->parent = y;
+        }
+        transplant(z, y);
+        y->left = z->left;
+        y->left->parent = y;
+        y->red = z->red;
+      }
+
+      z->parent = z->left = z->right = nullptr;
+      m_size--;
+
+      propagate(xParent);
+      if(!removedRed) erase_fixup(x, xParent);
+    }
+
+    // First element whose key is not less than key
+    T* lower_bound(const key_type& key) const {
+      RbNode* n = m_root;
+      RbNode* result = nullptr;
+      while(n != nullptr) {
+        if(Compare()(KeyOf()(*owner(n)), key)) {
+          n = n->right;
+        } else {
+          result = n;
+          n = n->left;
+        }
+      }
+      return result ? owner(result) : nullptr;
+    }
+
+    // First element whose key is greater than key
+    T* upper_bound(const key_type& key) const {
+      RbNode* n = m_root;
+      RbNode* result = nullptr;
+      while(n != nullptr) {
+        if(Compare()(key, KeyOf()(*owner(n)))) {
+          result = n;
+          n = n->left;
+        } else {
+          n = n->right;
+        }
+      }
+      return result ? owner(result) : nullptr;
+    }
+
+    T* find(const key_type& key) const {
+      T* v = lower_bound(key);
+      if(v != nullptr && !Compare()(key, KeyOf()(*v))) return v;
+      return nullptr;
+    }
+
+    // Recomputes the augmented data of v and its ancestors, after changing
+    // something it depends on in place
+    void update(T& v) {
+      propagate(&(v.*Node));
+    }
+
+  private:
+    static T* owner(RbNode* n) {
+      // container_of, with a fake non-null base to compute the offset
+      constexpr uintptr_t base = 0x1000;
+      uintptr_t offset = (uintptr_t)&(reinterpret_cast<T*>(base)->*Node) - base;
+      return reinterpret_cast<T*>((uintptr_t)n - offset);
+    }
+
+    static RbNode* leftmost(RbNode* n) {
+      while(n->left != nullptr) n = n->left;
+      return n;
+    }
+
+    static RbNode* rightmost(RbNode* n) {
+      while(n->right != nullptr) n = n->right;
+      return n;
+    }
+
+    static RbNode* successor(RbNode* n) {
+      if(n->right != nullptr) return leftmost(n->right);
+      while(n->parent != nullptr && n == n->parent->right) n = n->parent;
+      return n->parent;
+    }
+
+    static RbNode* predecessor(RbNode* n) {
+      if(n->left != nullptr) return rightmost(n->left);
+      while(n->parent != nullptr && n == n->parent->left) n = n->parent;
+      return n->parent;
+    }
+
+    static bool is_red(RbNode* n) {
+      return n != nullptr && n->red;
+    }
+
+    static void augment(RbNode* n) {
+      Augment::update(*owner(n));
+    }
+
+    static void propagate(RbNode* n) {
+      for(; n != nullptr; n = n->parent) augment(n);
+    }
+
+    // Puts v where u was, u's subtrees are left to the caller
+    void transplant(RbNode* u, RbNode* v) {
+      if(u->parent == nullptr) {
+        m_root = v;
+      } else if(u == u->parent->left) {
+        u->parent->left = v;
+      } else {
+        u->parent->right = v;
+      }
+      if(v != nullptr) v->parent = u->parent;
+    }
+
+    void rotate_left(RbNode* x) {
+      RbNode* y = x->right;
+      x->right = y->left;
+      if(y->left != nullptr) y->left->parent = x;
+      transplant(x, y);
+      y->left = x;
+      x->parent = y;
+      augment(x);
+      augment(y);
+    }
+
+    void rotate_right(RbNode* x) {
+      RbNode* y = x->left;
+      x->left = y->right;
+      if(y->right != nullptr) y->right->parent = x;
+      transplant(x, y);
+      y->right = x;
+      x->parent = y;
+      augment(x);
+      augment(y);
+    }
+
+    void insert_fixup(RbNode* z) {
+      while(is_red(z->parent)) {
+        RbNode* p = z->parent;
+        RbNode* g = p->parent;
+        if(p == g->left) {
+          RbNode* uncle = g->right;
+          if(is_red(uncle)) {
+            p->red = uncle->red = false;
+            g->red = true;
+            z = g;
+            continue;
+          }
+          if(z == p->right) {
+            rotate_left(p);
+            z = p;
+            p = z->parent;
+          }
+          p->red = false;
+          g->red = true;
+          rotate_right(g);
+        } else {
+          RbNode* uncle = g->left;
+          if(is_red(uncle)) {
+            p->red = uncle->red = false;
+            g->red = true;
+            z = g;
+            continue;
+          }
+          if(z == p->left) {
+            rotate_right(p);
+            z = p;
+            p = z->parent;
+          }
+          p->red = false;
+          g->red = true;
+          rotate_left(g);
+        }
+      }
+      m_root->red = false;
+    }
+
+    void erase_fixup(RbNode* x, RbNode* parent) {
+      while(x != m_root && !is_red(x)) {
+        if(x == parent->left) {
+          RbNode* w = parent->right;
+          if(is_red(w)) {
+            w->red = false;
+            parent->red = true;
+            rotate_left(parent);
+            w = parent->right;
+          }
+          if(!is_red(w->left) && !is_red(w->right)) {
+            w->red = true;
+            x = parent;
+            parent = x->parent;
+          } else {
+            if(!is_red(w->right)) {
+              w->left->red = false;
+              w->red = true;
+              rotate_right(w);
+              w = parent->right;
+            }
+            w->red = parent->red;
+            parent->red = false;
+            if(w->right) w->right->red = false;
+            rotate_left(parent);
+            x = m_root;
+          }
+        } else {
+          RbNode* w = parent->left;
+          if(is_red(w)) {
+            w->red = false;
+            parent->red = true;
+            rotate_right(parent);
+            w = parent->left;
+          }
+          if(!is_red(w->left) && !is_red(w->right)) {
+            w->red = true;
+            x = parent;
+            parent = x->parent;
+          } else {
+            if(!is_red(w->left)) {
+              w->right->red = false;
+              w->red = true;
+              rotate_left(w);
+              w = parent->left;
+            }
+            w->red = parent->red;
+            parent->red = false;
+            if(w->left) w->left->red = false;
+            rotate_right(parent);
+            x = m_root;
+          }
+        }
+      }
+      if(x != nullptr) x->red = false;
+    }
+
+    RbNode* m_root = nullptr;
+    size_t m_size = 0;
+  };
+
+  // Red-black tree of half-open ranges [start, end) ordered by start, where
+  // every node also caches the largest end in its subtree. Traits provides
+  // key_type and static start(const T&), end(const T&), max_end(T&) (the
+  // cached value, a reference).
+  template<typename T, RbNode T::*Node, typename Traits>
+  class IntervalTree {
+  public:
+    using key_type = typename Traits::key_type;
+
+    bool empty() const { return m_tree.empty(); }
+    size_t size() const { return m_tree.size(); }
+    T* first() const { return m_tree.first(); }
+    static T* next(T& v) { return Tree::next(v); }
+
+    void insert(T& v) {
+      Traits::max_end(v) = Traits::end(v);
+      m_tree.insert(v);
+    }
+
+    void erase(T& v) {
+      m_tree.erase(v);
+    }
+
+    // The range containing point, if any
+    T* find_containing(key_type point) const {
+      return first_overlap(point, point + 1);
+    }
+
+    // The overlapping range with the lowest start
+    T* first_overlap(key_type start, key_type end) const {
+      T* n = m_tree.root();
+      T* result = nullptr;
+      while(n != nullptr) {
+        T* l = Tree::left(*n);
+        if(l != nullptr && Traits::max_end(*l) > start) {
+          // Anything overlapping in the left subtree starts lower
+          if(overlaps(*n, start, end)) result = n;
+          n = l;
+        } else if(overlaps(*n, start, end)) {
+          return n;
+        } else if(Traits::start(*n) >= end) {
+          return result;
+        } else {
+          n = Tree::right(*n);
+        }
+      }
+      return result;
+    }
+
+    // Calls fn(T&) for every range overlapping [start, end), by start order
+    template<typename F>
+    void for_each_overlap(key_type start, key_type end, F&& fn) const {
+      visit(m_tree.root(), start, end, fn);
+    }
+
+  private:
+    struct KeyOf {
+      using key_type = typename Traits::key_type;
+      key_type operator()(const T& v) const { return Traits::start(v); }
+    };
+
+    struct Augment {
+      static void update(T& v) {
+        key_type m = Traits::end(v);
+        T* l = Tree::left(v);
+        T* r = Tree::right(v);
+        if(l != nullptr && Traits::max_end(*l) > m) m = Traits::max_end(*l);
+        if(r != nullptr && Traits::max_end(*r) > m) m = Traits::max_end(*r);
+        Traits::max_end(v) = m;
+      }
+    };
+
+    using Tree = RbTree<T, Node, KeyOf, std::less<key_type>, Augment>;
+
+    static bool overlaps(const T& v, key_type start, key_type end) {
+      return Traits::start(v) < end && start < Traits::end(v);
+    }
+
+    template<typename F>
+    static void visit(T* n, key_type start, key_type end, F& fn) {
+      if(n == nullptr || Traits::max_end(*n) <= start) return;
+      visit(Tree::left(*n), start, end, fn);
+      if(Traits::start(*n) >= end) return;
+      if(overlaps(*n, start, end)) fn(*n);
+      visit(Tree::right(*n), start, end, fn);
+    }
+
+    Tree m_tree;
+  };
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <stddef.h>
+#include <atomic.h>
+
+namespace os {
+  // Reference count shared by the smart pointers. References are also taken
+  // and dropped from interrupt handlers, so while only one CPU runs every
+  // update is a single instruction an interrupt can't split. SMP builds
+  // (CONFIG_SMP) use locked atomic ones.
+  class RefCount {
+  public:
+    constexpr RefCount(size_t initial = 0) : m_count(initial) {}
+
+    RefCount(const RefCount&) = delete;
+    RefCount& operator=(const RefCount&) = delete;
+
+    void increment() {
+#ifdef CONFIG_SMP
+      m_count.fetch_add(1, std::memory_order_relaxed);
+#else
+      asm volatile("incl %0" : "+m"(m_count));
+#endif
+    }
+
+    // Like increment, unless the last reference is already gone (and the
+    // object is being destroyed). Returns whether a reference was taken.
+    bool try_increment() {
+#ifdef CONFIG_SMP
+      size_t count = m_count.load(std::memory_order_relaxed);
+      while(count != 0) {
+        if(m_count.compare_exchange_weak(count, count + 1, std::memory_order_relaxed,
+                                          std::memory_order_relaxed)) return true;
+      }
+      return false;
+#else
+      size_t count = m_count;
+      while(count != 0) {
+        bool swapped;
+        asm volatile("cmpxchgl %3, %0" : "+m"(m_count), "+a"(count), "=@ccz"(swapped) : "r"(count + 1));
+        if(swapped) return true;
+      }
+      return false;
+#endif
+    }
+
+    // Returns true when the last reference was dropped
+    bool decrement() {
+#ifdef CONFIG_SMP
+      return m_count.fetch_sub(1, std::memory_order_acq_rel) == 1;
+#else
+      bool zero;
+      asm volatile("decl %0" : "+m"(m_count), "=@ccz"(zero) : : "memory");
+      return zero;
+#endif
+    }
+
+    size_t count() const {
+#ifdef CONFIG_SMP
+      return m_count.load(std::memory_order_relaxed);
+#else
+      return m_count;
+#endif
+    }
+
+  private:
+#ifdef CONFIG_SMP
+    std::atomic<size_t> m_count;
+#else
+    size_t m_count;
+#endif
+  };
+}
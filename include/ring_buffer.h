@@ -0,0 +1,185 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic.h>
+
+namespace os {
+  // Bounded single-producer/single-consumer queue. Neither side ever blocks or
+  // allocates, so either of them can run inside an interrupt handler, as long
+  // as there really is only one context pushing and one context popping.
+  template<typename T, size_t N>
+  class SpscRingBuffer {
+    static_assert(N > 0 && (N & (N - 1)) == 0, "Ring buffer size must be a power of two");
+  public:
+    using value_type = T;
+    using size_type = size_t;
+
+    SpscRingBuffer()
+        : m_head(0)
+        , m_cachedTail(0)
+        , m_tail(0)
+        , m_cachedHead(0) {}
+
+    SpscRingBuffer(const SpscRingBuffer&) = delete;
+    SpscRingBuffer& operator=(const SpscRingBuffer&) = delete;
+
+    static constexpr size_t capacity() {
+      return N;
+    }
+
+    size_t size() const {
+      return m_tail.load(std::memory_order_acquire) - m_head.load(std::memory_order_acquire);
+    }
+
+    bool empty() const {
+      return size() == 0;
+    }
+
+    bool push(const T& v) {
+      return push(&v, 1) == 1;
+    }
+
+    // Pushes up to n items, returns how many actually fit
+    size_t push(const T* items, size_t n) {
+      size_t tail = m_tail.load(std::memory_order_relaxed);
+      size_t free = N - (tail - m_cachedHead);
+      if(free < n) {
+        m_cachedHead = m_head.load(std::memory_order_acquire);
+        free = N - (tail - m_cachedHead);
+      }
+
+      size_t count = n < free ? n : free;
+      for(size_t i = 0; i < count; i++) {
+        m_buffer[(tail + i) & mask] = items[i];
+      }
+      m_tail.store(tail + count, std::memory_order_release);
+      return count;
+    }
+
+    bool pop(T& out) {
+      return pop(&out, 1) == 1;
+    }
+
+    // Pops up to max items into out, returns how many were available
+    size_t pop(T* out, size_t max) {
+      size_t head = m_head.load(std::memory_order_relaxed);
+      size_t available = m_cachedTail - head;
+      if(available < max) {
+        m_cachedTail = m_tail.load(std::memory_order_acquire);
+        available = m_cachedTail - head;
+      }
+
+      size_t count = max < available ? max : available;
+      for(size_t i = 0; i < count; i++) {
+        out[i] = m_buffer[(head + i) & mask];
+      }
+      m_head.store(head + count, std::memory_order_release);
+      return count;
+    }
+
+  private:
+    static constexpr size_t mask = N - 1;
+
+    // Consumer side
+    alignas(cache_line_size) std::atomic<size_t> m_head;
+    size_t m_cachedTail;
+
+    // Producer side
+    alignas(cache_line_size) std::atomic<size_t> m_tail;
+    size_t m_cachedHead;
+
+    alignas(cache_line_size) T m_buffer[N];
+  };
+
+  // Bounded multi-producer/single-consumer queue. Producers reserve slots with
+  // a single CAS and publish each slot through its sequence number, so a
+  // producer interrupted half-way (e.g. by an IRQ handler that pushes too)
+  // never blocks the others: the consumer just stops at the unpublished slot
+  // until it has been filled.
+  template<typename T, size_t N>
+  class MpscRingBuffer {
+    static_assert(N > 0 && (N & (N - 1)) == 0, "Ring buffer size must be a power of two");
+  public:
+    using value_type = T;
+    using size_type = size_t;
+
+    MpscRingBuffer()
+        : m_head(0)
+        , m_tail(0) {}
+
+    MpscRingBuffer(const MpscRingBuffer&) = delete;
+    MpscRingBuffer& operator=(const MpscRingBuffer&) = delete;
+
+    static constexpr size_t capacity() {
+      return N;
+    }
+
+    size_t size() const {
+      return m_tail.load(std::memory_order_acquire) - m_head.load(std::memory_order_acquire);
+    }
+
+    bool empty() const {
+      return size() == 0;
+    }
+
+    bool push(const T& v) {
+      return push(&v, 1) == 1;
+    }
+
+    // Pushes up to n items, returns how many actually fit
+    size_t push(const T* items, size_t n) {
+      size_t tail = m_tail.load(std::memory_order_relaxed);
+      size_t count;
+      do {
+        size_t head = m_head.load(std::memory_order_acquire);
+        size_t free = N - (tail - head);
+        count = n < free ? n : free;
+        if(count == 0) return 0;
+      } while(!m_tail.compare_exchange_weak(tail, tail + count,
+                std::memory_order_relaxed, std::memory_order_relaxed));
+
+      for(size_t i = 0; i < count; i++) {
+        Slot& slot = m_slots[(tail + i) & mask];
+        slot.value = items[i];
+        slot.sequence.store(tail + i + 1, std::memory_order_release);
+      }
+      return count;
+    }
+
+    bool pop(T& out) {
+      return pop(&out, 1) == 1;
+    }
+
+    // Pops up to max published items into out, returns how many were popped
+    size_t pop(T* out, size_t max) {
+      size_t head = m_head.load(std::memory_order_relaxed);
+      size_t count = 0;
+      while(count < max) {
+        Slot& slot = m_slots[(head + count) & mask];
+        if(slot.sequence.load(std::memory_order_acquire) != head + count + 1) break;
+        out[count++] = slot.value;
+      }
+      if(count > 0) {
+        m_head.store(head + count, std::memory_order_release);
+      }
+      return count;
+    }
+
+  private:
+    static constexpr size_t mask = N - 1;
+
+    struct Slot {
+      std::atomic<size_t> sequence;
+      T value;
+    };
+
+    // Consumer side
+    alignas(cache_line_size) std::atomic<size_t> m_head;
+
+    // Producer side
+    alignas(cache_line_size) std::atomic<size_t> m_tail;
+
+    alignas(cache_line_size) Slot m_slots[N];
+  };
+}
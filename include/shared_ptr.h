@@ -4,100 +4,163 @@
 #include <stdint.h>
 #include <kassert.h>
 #include <function_objects.h>
+#include <object_pool.h>
+#include <refcount.h>
+#include <new.h>
+#include <utility.h>
+#include <type_traits.h>
 
 namespace os {
   namespace std {
+    template<typename T>
+    class shared_ptr;
+
+    template<typename T, typename... Args>
+    shared_ptr<T> make_shared(Args&&... args);
+
+    namespace detail {
+      // Reference count and disposal, shared by all the owners of an object
+      struct control_block {
+        RefCount refcount;
+        void (*dispose)(control_block* self);
+
+        control_block(void (*d)(control_block*)) : refcount(1), dispose(d) {}
+      };
+
+      // For objects allocated by the user, the block points to them
+      template<typename T>
+      struct pointer_block : control_block {
+        T* ptr;
+
+        pointer_block(T* p) : control_block(&destroy), ptr(p) {}
+
+        static void destroy(control_block* self) {
+          auto b = static_cast<pointer_block*>(self);
+          delete b->ptr;
+          ObjectPool<pointer_block>::instance().destroy(b);
+        }
+      };
+
+      // For make_shared, the object lives in the block itself
+      template<typename T>
+      struct inplace_block : control_block {
+        alignas(T) uint8_t storage[sizeof(T)];
+
+        inplace_block() : control_block(&destroy) {}
+
+        T* object() {
+          return reinterpret_cast<T*>(storage);
+        }
+
+        static void destroy(control_block* self) {
+          auto b = static_cast<inplace_block*>(self);
+          b->object()->~T();
+          ObjectPool<inplace_block>::instance().destroy(b);
+        }
+      };
+    }
+
     template<typename T>
     class shared_ptr {
     public:
       using nullptr_t = decltype(nullptr);
 
-      shared_ptr() : m_data(nullptr) {}
-      shared_ptr(nullptr_t) : m_data(nullptr) {}
-      explicit shared_ptr(T* ptr) {
+      shared_ptr() : m_ptr(nullptr), m_block(nullptr) {}
+      shared_ptr(nullptr_t) : m_ptr(nullptr), m_block(nullptr) {}
+      explicit shared_ptr(T* ptr) : m_ptr(ptr), m_block(nullptr) {
         if(ptr != nullptr) {
-          m_data = new shared_data();
-          m_data->ptr = ptr;
-          m_data->refcount = 1;
-        } else {
-          m_data = nullptr;
+          m_block = ObjectPool<detail::pointer_block<T>>::instance().create(ptr);
         }
       }
 
-      shared_ptr(const shared_ptr& p) {
-        if(p) {
-          m_data = p.m_data;
-          m_data->refcount++;
-        } else {
-          m_data = nullptr;
-        }
+      shared_ptr(const shared_ptr& p) : m_ptr(p.m_ptr), m_block(p.m_block) {
+        if(m_block != nullptr) m_block->refcount.increment();
+      }
+
+      shared_ptr(shared_ptr&& p) : m_ptr(p.m_ptr), m_block(p.m_block) {
+        p.m_ptr = nullptr;
+        p.m_block = nullptr;
       }
 
       ~shared_ptr() {
-        if(m_data != nullptr) {
-          m_data->refcount--;
-          if(m_data->refcount == 0) {
-            delete m_data->ptr;
-            delete m_data;
-          }
-        }
+        release();
       }
 
       shared_ptr& operator=(const shared_ptr& p) {
-        if(m_data != nullptr && m_data != p.m_data) {
-          m_data->refcount--;
-          if(m_data->refcount == 0) {
-            delete m_data->ptr;
-            delete m_data;
-          }
-        }
-
-        m_data = p.m_data;
-        if(m_data != nullptr) m_data->refcount++;
+        shared_ptr(p).swap(*this);
+        return *this;
+      }
 
+      shared_ptr& operator=(shared_ptr&& p) {
+        shared_ptr(static_cast<shared_ptr&&>(p)).swap(*this);
         return *this;
       }
 
+      void swap(shared_ptr& other) {
+        T* ptr = m_ptr;
+        detail::control_block* block = m_block;
+        m_ptr = other.m_ptr;
+        m_block = other.m_block;
+        other.m_ptr = ptr;
+        other.m_block = block;
+      }
+
+      void reset() {
+        release();
+        m_ptr = nullptr;
+        m_block = nullptr;
+      }
+
       T* get() const {
-        if(m_data) {
-          return m_data->ptr;
-        }
-        return nullptr;
+        return m_ptr;
       }
 
       T& operator*() const {
-        assert(m_data != nullptr);
-        return *(m_data->ptr);
+        assert(m_ptr != nullptr);
+        return *m_ptr;
       }
 
       T* operator->() const {
-        assert(m_data != nullptr);
-        return get();
+        assert(m_ptr != nullptr);
+        return m_ptr;
       }
 
       size_t use_count() const {
-        if(m_data == nullptr) return 0;
-        return m_data->refcount;
+        if(m_block == nullptr) return 0;
+        return m_block->refcount.count();
       }
 
       explicit operator bool() const {
-        return m_data != nullptr;
+        return m_ptr != nullptr;
       }
 
     private:
-      struct shared_data {
-        T* ptr;
-        size_t refcount;
-      };
+      template<typename U, typename... Args>
+      friend shared_ptr<U> make_shared(Args&&... args);
+
+      shared_ptr(T* ptr, detail::control_block* block) : m_ptr(ptr), m_block(block) {}
 
-      shared_data* m_data;
+      void release() {
+        if(m_block != nullptr && m_block->refcount.decrement()) {
+          m_block->dispose(m_block);
+        }
+      }
+
+      T* m_ptr;
+      detail::control_block* m_block;
     };
 
+    // Allocates the object and its reference count together
     template<typename T, typename... Args>
     shared_ptr<T> make_shared(Args&&... args) {
-      return shared_ptr<T>(new T(args...));
+      auto block = ObjectPool<detail::inplace_block<T>>::instance().create();
+      T* ptr = new (block->object()) T(forward<Args>(args)...);
+      return shared_ptr<T>(ptr, block);
     }
 
+    template<typename T>
+    struct is_trivially_relocatable<shared_ptr<T>> : true_type {};
+
     template<typename T, typename U>
     bool operator==(const shared_ptr<T>& lhs, const shared_ptr<U>& rhs) {
       return lhs.get() == rhs.get();
@@ -115,7 +178,7 @@ namespace os {
 
     template<typename T>
     bool operator!=(const shared_ptr<T>& lhs, nullptr_t) {
-      return lhs;
+      return static_cast<bool>(lhs);
     }
 
     template<typename T>
@@ -135,7 +198,7 @@ namespace os {
 
     template<typename T>
     bool operator>=(const shared_ptr<T>& lhs, const shared_ptr<T>& rhs) {
-      return greater_equal<T>()(lhs.get(), rhs.get());
+      return greater_equal<T*>()(lhs.get(), rhs.get());
     }
   }
 }
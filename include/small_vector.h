@@ -0,0 +1,284 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <kassert.h>
+#include <kallocator.h>
+#include <new.h>
+#include <type_traits.h>
+#include <utility.h>
+
+namespace os {
+  // Same interface as std::vector, but the first N elements live inside the
+  // object itself. The heap is only used once the list grows beyond N, so
+  // short lists cost no allocation at all. Zero-initialized means empty.
+  template<typename T, size_t N, typename Allocator = os::KernelAllocator<T>>
+  class small_vector {
+  public:
+    using value_type = T;
+    using allocator_type = Allocator;
+    using reference = T&;
+    using const_reference = const T&;
+    using pointer = T*;
+    using const_pointer = const T*;
+    using size_type = size_t;
+    using difference_type = ptrdiff_t;
+    using iterator = T*;
+    using const_iterator = const T*;
+
+    small_vector()
+        : m_alloc(), m_heap(nullptr), m_size(0), m_capacity(0) {}
+
+    explicit small_vector(const Allocator& alloc)
+        : m_alloc(alloc), m_heap(nullptr), m_size(0), m_capacity(0) {}
+
+    small_vector(const small_vector& other)
+        : m_alloc(other.m_alloc), m_heap(nullptr), m_size(0), m_capacity(0) {
+      reserve(other.m_size);
+      for(const T& v : other) {
+        new (data() + m_size) T(v);
+        m_size++;
+      }
+    }
+
+    small_vector(small_vector&& other)
+        : m_alloc(other.m_alloc), m_heap(nullptr), m_size(0), m_capacity(0) {
+      take(other);
+    }
+
+    ~small_vector() {
+      clear();
+      free_heap();
+    }
+
+    small_vector& operator=(const small_vector& other) {
+      if(this != &other) {
+        clear();
+        reserve(other.m_size);
+        for(const T& v : other) {
+          new (data() + m_size) T(v);
+          m_size++;
+        }
+      }
+      return *this;
+    }
+
+    small_vector& operator=(small_vector&& other) {
+      if(this != &other) {
+        clear();
+        free_heap();
+        m_alloc = other.m_alloc;
+        take(other);
+      }
+      return *this;
+    }
+
+    reference operator[](size_t i) {
+      return data()[i];
+    }
+
+    const_reference operator[](size_t i) const {
+      return data()[i];
+    }
+
+    reference at(size_t i) {
+      assert(i < m_size);
+      return data()[i];
+    }
+
+    const_reference at(size_t i) const {
+      assert(i < m_size);
+      return data()[i];
+    }
+
+    reference front() {
+      return *data();
+    }
+
+    const_reference front() const {
+      return *data();
+    }
+
+    reference back() {
+      return data()[m_size - 1];
+    }
+
+    const_reference back() const {
+      return data()[m_size - 1];
+    }
+
+    pointer data() {
+      return m_heap != nullptr ? m_heap : inline_data();
+    }
+
+    const_pointer data() const {
+      return m_heap != nullptr ? m_heap : inline_data();
+    }
+
+    iterator begin() {
+      return data();
+    }
+
+    const_iterator begin() const {
+      return data();
+    }
+
+    const_iterator cbegin() const {
+      return data();
+    }
+
+    iterator end() {
+      return data() + m_size;
+    }
+
+    const_iterator end() const {
+      return data() + m_size;
+    }
+
+    const_iterator cend() const {
+      return data() + m_size;
+    }
+
+    bool empty() const {
+      return m_size == 0;
+    }
+
+    size_t size() const {
+      return m_size;
+    }
+
+    size_t max_size() const {
+      return (size_t)-1 / sizeof(T);
+    }
+
+    size_t capacity() const {
+      return m_heap != nullptr ? m_capacity : N;
+    }
+
+    // Whether the elements are stored inline
+    bool is_small() const {
+      return m_heap == nullptr;
+    }
+
+    void reserve(size_t n) {
+      if(n > capacity()) reallocate(n);
+    }
+
+    // Moves the elements back inline when they fit
+    void shrink_to_fit() {
+      if(m_heap == nullptr || m_size == m_capacity) return;
+      if(m_size <= N) {
+        T* heap = m_heap;
+        size_t heapCapacity = m_capacity;
+        m_heap = nullptr;
+        relocate(heap, inline_data(), m_size);
+        m_alloc.deallocate(heap, heapCapacity);
+      } else {
+        reallocate(m_size);
+      }
+    }
+
+    // Destroys the elements, the storage is kept
+    void clear() {
+      if(!std::is_trivially_destructible<T>::value) {
+        T* d = data();
+        for(size_t i = 0; i < m_size; i++) d[i].~T();
+      }
+      m_size = 0;
+    }
+
+    void push_back(const T& v) {
+      emplace_back(v);
+    }
+
+    void push_back(T&& v) {
+      emplace_back(std::move(v));
+    }
+
+    template<typename... Args>
+    reference emplace_back(Args&&... args) {
+      if(m_size == capacity()) {
+        // Construct before moving the old elements, args may refer to one
+        size_t newCapacity = capacity() * 2;
+        T* buffer = m_alloc.allocate(newCapacity);
+        new (buffer + m_size) T(std::forward<Args>(args)...);
+        adopt(buffer, newCapacity);
+      } else {
+        new (data() + m_size) T(std::forward<Args>(args)...);
+      }
+      return data()[m_size++];
+    }
+
+    void pop_back() {
+      m_size--;
+      data()[m_size].~T();
+    }
+
+    allocator_type get_allocator() const {
+      return m_alloc;
+    }
+
+  private:
+    static_assert(N > 0, "Use vector when nothing is stored inline");
+
+    T* inline_data() {
+      return reinterpret_cast<T*>(m_inline);
+    }
+
+    const T* inline_data() const {
+      return reinterpret_cast<const T*>(m_inline);
+    }
+
+    static void relocate(T* from, T* to, size_t n) {
+      if(std::is_trivially_relocatable<T>::value) {
+        memcpy((void*)to, (const void*)from, n * sizeof(T));
+      } else {
+        for(size_t i = 0; i < n; i++) {
+          new (to + i) T(std::move(from[i]));
+          from[i].~T();
+        }
+      }
+    }
+
+    void reallocate(size_t newCapacity) {
+      adopt(m_alloc.allocate(newCapacity), newCapacity);
+    }
+
+    // Moves the elements to a heap buffer and releases the old storage
+    void adopt(T* buffer, size_t newCapacity) {
+      relocate(data(), buffer, m_size);
+      free_heap();
+      m_heap = buffer;
+      m_capacity = newCapacity;
+    }
+
+    void free_heap() {
+      if(m_heap != nullptr) {
+        m_alloc.deallocate(m_heap, m_capacity);
+        m_heap = nullptr;
+        m_capacity = 0;
+      }
+    }
+
+    // Steals other's heap buffer, or moves its inline elements one by one
+    void take(small_vector& other) {
+      if(other.m_heap != nullptr) {
+        m_heap = other.m_heap;
+        m_capacity = other.m_capacity;
+        other.m_heap = nullptr;
+        other.m_capacity = 0;
+      } else {
+        relocate(other.inline_data(), inline_data(), other.m_size);
+      }
+      m_size = other.m_size;
+      other.m_size = 0;
+    }
+
+    Allocator m_alloc;
+    T* m_heap;
+    size_t m_size;
+    size_t m_capacity;
+    alignas(T) uint8_t m_inline[N * sizeof(T)];
+  };
+}
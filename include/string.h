@@ -9,12 +9,15 @@ extern "C" {
 void * memmove ( void * destination, const void * source, size_t num );
 void * memcpy ( void * destination, const void * source, size_t num );
 int memcmp ( const void * ptr1, const void * ptr2, size_t num );
+void * memchr ( const void * ptr, int value, size_t num );
 void * memset ( void * ptr, int value, size_t num );
 size_t strlen(const char* c);
+size_t strnlen(const char* c, size_t max);
 char * strdup(const char *str1);
 char * strchr (const char * str, int character );
 char *strcpy(char *dst, const char *src);
 int strcmp(const char *str1, const char *str2);
+int strncmp(const char *str1, const char *str2, size_t num);
 
 #ifdef __cplusplus
 }
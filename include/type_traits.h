@@ -12,7 +12,7 @@ namespace os {
         return v;
       }
 
-      constexpr operator()() const noexcept {
+      constexpr value_type operator()() const noexcept {
         return v;
       }
     };
@@ -32,5 +32,87 @@ namespace os {
     struct conditional<false, T, F> {
       using type = F;
     };
+
+    template<bool B, typename T, typename F>
+    using conditional_t = typename conditional<B, T, F>::type;
+
+    template<typename T>
+    struct remove_reference {
+      using type = T;
+    };
+
+    template<typename T>
+    struct remove_reference<T&> {
+      using type = T;
+    };
+
+    template<typename T>
+    struct remove_reference<T&&> {
+      using type = T;
+    };
+
+    template<typename T>
+    using remove_reference_t = typename remove_reference<T>::type;
+
+    template<typename T>
+    struct remove_cv {
+      using type = T;
+    };
+
+    template<typename T>
+    struct remove_cv<const T> {
+      using type = T;
+    };
+
+    template<typename T>
+    struct remove_cv<volatile T> {
+      using type = T;
+    };
+
+    template<typename T>
+    struct remove_cv<const volatile T> {
+      using type = T;
+    };
+
+    template<typename T>
+    using remove_cv_t = typename remove_cv<T>::type;
+
+    template<typename T>
+    using remove_cvref_t = remove_cv_t<remove_reference_t<T>>;
+
+    template<bool B, typename T = void>
+    struct enable_if {};
+
+    template<typename T>
+    struct enable_if<true, T> {
+      using type = T;
+    };
+
+    template<bool B, typename T = void>
+    using enable_if_t = typename enable_if<B, T>::type;
+
+    template<typename T, typename U>
+    struct is_same : false_type {};
+
+    template<typename T>
+    struct is_same<T, T> : true_type {};
+
+    template<typename T>
+    struct is_lvalue_reference : false_type {};
+
+    template<typename T>
+    struct is_lvalue_reference<T&> : true_type {};
+
+    template<typename T>
+    struct is_trivially_copyable : bool_constant<__is_trivially_copyable(T)> {};
+
+    template<typename T>
+    struct is_trivially_destructible : bool_constant<__has_trivial_destructor(T)> {};
+
+    // Whether moving a T and destroying the source is the same as copying its
+    // bytes. True for trivially copyable types and for types that opt in,
+    // e.g. smart pointers that merely hold pointers to their data.
+    template<typename T>
+    struct is_trivially_relocatable : is_trivially_copyable<T> {};
   }
 }
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <type_traits.h>
+
+namespace os {
+  namespace std {
+    template<typename T>
+    constexpr remove_reference_t<T>&& move(T&& t) noexcept {
+      return static_cast<remove_reference_t<T>&&>(t);
+    }
+
+    template<typename T>
+    constexpr T&& forward(remove_reference_t<T>& t) noexcept {
+      return static_cast<T&&>(t);
+    }
+
+    template<typename T>
+    constexpr T&& forward(remove_reference_t<T>&& t) noexcept {
+      static_assert(!is_lvalue_reference<T>::value, "Can't forward an rvalue as an lvalue");
+      return static_cast<T&&>(t);
+    }
+
+    template<typename T>
+    void swap(T& a, T& b) {
+      T tmp = move(a);
+      a = move(b);
+      b = move(tmp);
+    }
+  }
+}
@@ -2,15 +2,22 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include <string.h>
 #include <kassert.h>
-#include <stdlib.h>
+#include <kallocator.h>
+#include <new.h>
+#include <type_traits.h>
+#include <utility.h>
 
 namespace os {
   namespace std {
-    template<typename T>
+    // A zero-initialized vector is a valid empty one, so they can be used as
+    // globals without running constructors
+    template<typename T, typename Allocator = os::KernelAllocator<T>>
     class vector {
     public:
       using value_type = T;
+      using allocator_type = Allocator;
       using reference = T&;
       using const_reference = const T&;
       using pointer = T*;
@@ -20,6 +27,57 @@ namespace os {
       using iterator = T*;
       using const_iterator = const T*;
 
+      vector()
+          : m_alloc(), m_buffer(nullptr), m_size(0), m_capacity(0) {}
+
+      explicit vector(const Allocator& alloc)
+          : m_alloc(alloc), m_buffer(nullptr), m_size(0), m_capacity(0) {}
+
+      vector(const vector& other)
+          : m_alloc(other.m_alloc), m_buffer(nullptr), m_size(0), m_capacity(0) {
+        reserve(other.m_size);
+        for(const T& v : other) {
+          new (m_buffer + m_size) T(v);
+          m_size++;
+        }
+      }
+
+      vector(vector&& other)
+          : m_alloc(other.m_alloc), m_buffer(other.m_buffer)
+          , m_size(other.m_size), m_capacity(other.m_capacity) {
+        other.m_buffer = nullptr;
+        other.m_size = 0;
+        other.m_capacity = 0;
+      }
+
+      ~vector() {
+        clear();
+        if(m_buffer != nullptr) m_alloc.deallocate(m_buffer, m_capacity);
+      }
+
+      vector& operator=(const vector& other) {
+        if(this != &other) {
+          vector tmp(other);
+          swap(tmp);
+        }
+        return *this;
+      }
+
+      vector& operator=(vector&& other) {
+        if(this != &other) {
+          vector tmp(move(other));
+          swap(tmp);
+        }
+        return *this;
+      }
+
+      void swap(vector& other) {
+        std::swap(m_alloc, other.m_alloc);
+        std::swap(m_buffer, other.m_buffer);
+        std::swap(m_size, other.m_size);
+        std::swap(m_capacity, other.m_capacity);
+      }
+
       reference operator[](size_t i) {
         return m_buffer[i];
       }
@@ -95,32 +153,102 @@ namespace os {
       }
 
       size_t max_size() const {
-        return (size_t)-1;
+        return (size_t)-1 / sizeof(T);
       }
 
       size_t capacity() const {
         return m_capacity;
       }
-      
+
+      void reserve(size_t n) {
+        if(n > m_capacity) reallocate(n);
+      }
+
+      void shrink_to_fit() {
+        if(m_size == m_capacity) return;
+        if(m_size == 0) {
+          m_alloc.deallocate(m_buffer, m_capacity);
+          m_buffer = nullptr;
+          m_capacity = 0;
+        } else {
+          reallocate(m_size);
+        }
+      }
+
+      // Destroys the elements, the storage is kept
+      void clear() {
+        if(!is_trivially_destructible<T>::value) {
+          for(size_t i = 0; i < m_size; i++) m_buffer[i].~T();
+        }
+        m_size = 0;
+      }
+
       void push_back(const T& v) {
-        if(m_capacity == 0) {
-          m_capacity = 16;
-          m_buffer = (T*)malloc(sizeof(T) * 16);
-        } else if(m_capacity < m_size + 1) {
-          m_capacity *= 2;
-          m_buffer = (T*)realloc(m_buffer, sizeof(T) * m_capacity);
+        emplace_back(v);
+      }
+
+      void push_back(T&& v) {
+        emplace_back(move(v));
+      }
+
+      template<typename... Args>
+      reference emplace_back(Args&&... args) {
+        if(m_size == m_capacity) {
+          // Construct before moving the old elements, args may refer to one
+          size_t capacity = grown_capacity();
+          T* buffer = m_alloc.allocate(capacity);
+          new (buffer + m_size) T(forward<Args>(args)...);
+          relocate(buffer);
+          m_capacity = capacity;
+        } else {
+          new (m_buffer + m_size) T(forward<Args>(args)...);
         }
-        m_buffer[m_size++] = v;
+        return m_buffer[m_size++];
       }
 
       void pop_back() {
         m_size--;
         m_buffer[m_size].~T();
       }
+
+      allocator_type get_allocator() const {
+        return m_alloc;
+      }
+
     private:
+      static constexpr size_t initial_capacity = 8;
+
+      size_t grown_capacity() const {
+        return m_capacity == 0 ? initial_capacity : m_capacity * 2;
+      }
+
+      void reallocate(size_t capacity) {
+        assert(capacity >= m_size);
+        T* buffer = m_alloc.allocate(capacity);
+        relocate(buffer);
+        m_capacity = capacity;
+      }
+
+      // Moves the elements to buffer, frees the old storage and adopts buffer
+      void relocate(T* buffer) {
+        if(m_buffer != nullptr) {
+          if(is_trivially_relocatable<T>::value) {
+            memcpy((void*)buffer, (const void*)m_buffer, m_size * sizeof(T));
+          } else {
+            for(size_t i = 0; i < m_size; i++) {
+              new (buffer + i) T(move(m_buffer[i]));
+              m_buffer[i].~T();
+            }
+          }
+          m_alloc.deallocate(m_buffer, m_capacity);
+        }
+        m_buffer = buffer;
+      }
+
+      Allocator m_alloc;
       T* m_buffer;
       size_t m_size;
       size_t m_capacity;
     };
   }
-}
\ No newline at end of file
+}
@@ -2,6 +2,7 @@
 
 #include "screen.h"
 #include "ports.h"
+#include "deferred.h"
 #include <array.h>
 #include <kassert.h>
 
@@ -42,4 +43,6 @@ void irq_handler(Registers* regs) {
     auto handler = interrupt_handlers[regs->int_no];
     if(handler != nullptr) handler(regs);
   }
+
+  os::Deferred::run_softirqs();
 }
\ No newline at end of file
@@ -17,7 +17,7 @@ void* kmalloc(size_t size) {
 }
 
 void* kmalloc_align(size_t size, void** physical) {
-  if (placement_address & 0xFFFFF000) {
+  if (placement_address & 0x00000FFF) {
     // Align the placement address;
     placement_address &= 0xFFFFF000;
     placement_address += 0x1000;
@@ -4,6 +4,9 @@
 #include <stddef.h>
 #include <kassert.h>
 
+// Until paging is enabled, kmalloc hands out memory from this address up
+extern uintptr_t placement_address;
+
 void* kmalloc(size_t size);
 
 void* kmalloc_align(size_t size, void** physical);
@@ -16,6 +19,16 @@ void kfree(void *p);
 
 void* krealloc(void* ptr, size_t s);
 
+// Virtually contiguous allocations, backed by frames that can be anywhere in
+// physical memory. Rounded up to whole pages and not usable for DMA.
+void* vmalloc(size_t size);
+
+// Same as vmalloc, but frames are only allocated (and zeroed) when a page is
+// first accessed
+void* vmalloc_lazy(size_t size);
+
+void vfree(void* p);
+
 namespace os {
   template <class T>
   struct AlignedKernelAllocator {
@@ -33,4 +46,22 @@ namespace os {
   bool operator==(const AlignedKernelAllocator<T>&, const AlignedKernelAllocator<U>&) { return true; }
   template <class T, class U>
   bool operator!=(const AlignedKernelAllocator<T>&, const AlignedKernelAllocator<U>&) { return false; }
+
+  // For big tables that shouldn't need physically contiguous memory
+  template <class T>
+  struct VirtualAllocator {
+    typedef T value_type;
+    VirtualAllocator() = default;
+    template <class U> constexpr VirtualAllocator(const VirtualAllocator<U>&) noexcept {}
+    T* allocate(size_t n) {
+      if((n > (size_t)-1 / sizeof(T))) { panic("Bad allocation"); }
+      if(auto p = static_cast<T*>(vmalloc(n*sizeof(T)))) return p;
+      panic("Bad allocation");
+    }
+    void deallocate(T* p, size_t) noexcept { vfree(p); }
+  };
+  template <class T, class U>
+  bool operator==(const VirtualAllocator<T>&, const VirtualAllocator<U>&) { return true; }
+  template <class T, class U>
+  bool operator!=(const VirtualAllocator<T>&, const VirtualAllocator<U>&) { return false; }
 }
\ No newline at end of file
@@ -9,6 +9,15 @@
 #include <stdlib.h>
 #include "tasking.h"
 #include "debug.h"
+#include "deferred.h"
+#include "threadpool.h"
+#include "fpu.h"
+#include "cpu.h"
+#include "memory.h"
+#include "bench.h"
+#include "profiler.h"
+#include "ftrace.h"
+#include "sched_trace.h"
 
 #include <priority_queue.h>
 
@@ -32,10 +41,16 @@ int kmain(multiboot_info_t *mboot_ptr) {
 
   screen.write("Toy OS booting\n");
 
+  os::Cpu::init();
+  screen.write("CPU: % features %\n", os::Cpu::vendor(), (void*)os::Cpu::features());
+
   os::DescriptorTables::init();
   screen.write("Descriptor tables initialized\n");
+  os::Fpu::init();
+  os::Memory::init();
   asm volatile("sti");
   os::Timer::init(100);
+  os::Cpu::calibrate();
 
   multiboot_memory_map_t* mmap;
   if(mboot_ptr->flags & (1 << 6)) {
@@ -51,7 +66,23 @@ int kmain(multiboot_info_t *mboot_ptr) {
     os::Paging::getHeapSize() >> 10,
     os::Paging::getFreeHeap() >> 10);
 
+#ifdef CONFIG_BENCHMARKS
+  os::Benchmark::memory();
+  os::Benchmark::heap();
+#endif
+
   os::Tasking::init();
+  os::Deferred::init();
+  os::ThreadPool::init();
+#ifdef CONFIG_PROFILER
+  os::Profiler::start();
+#endif
+#ifdef CONFIG_FTRACE
+  os::FunctionTrace::start();
+#endif
+#ifdef CONFIG_SCHED_TRACE
+  os::SchedTrace::start();
+#endif
   auto t1 = os::Tasking::Task::start(&func);
 
   auto t2 = os::Tasking::Task::start(&func3);
@@ -62,6 +93,18 @@ int kmain(multiboot_info_t *mboot_ptr) {
   t3->wait();
   screen.write("t3 end\n");
 
+#ifdef CONFIG_PROFILER
+  os::Profiler::stop();
+  os::Profiler::report();
+  os::Profiler::dumpCollapsed();
+#endif
+#ifdef CONFIG_FTRACE
+  os::FunctionTrace::dump();
+#endif
+#ifdef CONFIG_SCHED_TRACE
+  os::SchedTrace::dump();
+#endif
+
   os::std::priority_queue<int> pq;
   pq.push(4);
   pq.push(10);
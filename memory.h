@@ -0,0 +1,31 @@
+#pragma once
+
+#include <stddef.h>
+
+namespace os {
+  namespace Memory {
+    using copy_function = void*(void* dst, const void* src, size_t n);
+    using set_function = void*(void* dst, int val, size_t n);
+
+    struct Variant {
+      const char* name;
+      copy_function* copy;
+      set_function* set;
+    };
+
+    /**
+     * \brief Picks the implementation memcpy and memset use for large sizes
+     *
+     * Must be called after Cpu::init and Fpu::init. Until then REP MOVSD and
+     * REP STOSD are used.
+     */
+    void init();
+
+    /**
+     * \brief Returns every implementation usable on this CPU, for benchmarking
+     *
+     * \param count Set to the number of variants
+     */
+    const Variant* variants(size_t& count);
+  }
+}
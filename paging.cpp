@@ -10,6 +10,8 @@
 #include "reflection.h"
 #include "screen.h"
 #include "synchro.h"
+#include "cpu.h"
+#include <percpu.h>
 
 using namespace os::Paging;
 
@@ -42,7 +44,52 @@ static os::bitset<>* memoryMap;
 static uintptr_t heapStart;
 static size_t heapSize = 0;
 
-static os::Spinlock spinlock;
+// Protects memoryMap and the zeroed page pool. Interrupts are disabled while
+// it's held, so the heap can be used from interrupt handlers.
+static os::IrqSpinlock spinlock;
+
+// Small per-CPU stock of free frames, so that single frame allocations only
+// touch the global bitmap once per batch. Only accessed by its own CPU with
+// interrupts disabled, which makes the common case lock-free.
+struct FrameCache {
+  static constexpr size_t capacity = 32;
+  static constexpr size_t batch = capacity / 2;
+
+  uintptr_t frames[capacity];
+  size_t count;
+};
+
+static os::PerCpu<FrameCache> frameCaches;
+
+// Kernel virtual range handed out by vmalloc. Its page tables are created at
+// boot and shared by every directory, so mappings show up everywhere at once.
+constexpr uintptr_t vmalloc_start = 0xE0000000;
+constexpr size_t vmalloc_size = 64 << 20;
+constexpr size_t vmalloc_first_table = vmalloc_start >> 22;
+constexpr size_t vmalloc_tables = vmalloc_size >> 22;
+
+// Meaning of the available PTE bits in the vmalloc range
+constexpr uint32_t vm_last = 1; // Last page of an allocation
+constexpr uint32_t vm_lazy = 2; // Backed by a zeroed frame on first access
+
+// Reserved pages of the vmalloc range
+static os::bitset<>* vmallocMap;
+static os::Spinlock vmallocLock;
+
+static bool inVmallocRange(uintptr_t addr) {
+  return addr >= vmalloc_start && addr - vmalloc_start < vmalloc_size;
+}
+
+static PageTableEntry& vmallocEntry(uintptr_t addr) {
+  assert(inVmallocRange(addr));
+  return kernel_directory->getTable(addr >> 22)[(addr >> 12) & 0x3FF];
+}
+
+static void invalidatePage(uintptr_t addr) {
+  asm volatile("invlpg (%0)" :: "r"(addr) : "memory");
+}
+
+static bool handleLazyFault(uintptr_t addr);
 
 bool os::Paging::heapActive() {
   return memoryMap != nullptr && current_directory != nullptr;
@@ -58,6 +105,8 @@ static void pageFaultHandler(os::Interrupts::Registers* regs) {
   int us = regs->err_code & 0x4;       // Processor was in user-mode?
   int reserved = regs->err_code & 0x8; // Overwritten CPU-reserved bits of page entry?
 
+  if(!present && handleLazyFault(faulting_address)) return;
+
   //uint32_t pde = (faulting_address & 0xFFC00000) >> 22;
   //uint32_t pte = (faulting_address & 0x003FF000) >> 12;
   
@@ -80,6 +129,13 @@ static void enablePaging() {
   asm volatile("mov %%cr0, %0": "=r"(cr0));
   cr0 |= 0x80000000; // Enable paging!
   asm volatile("mov %0, %%cr0":: "r"(cr0));
+
+  if(os::Cpu::has(os::Cpu::Feature::PGE)) {
+    uint32_t cr4;
+    asm volatile("mov %%cr4, %0": "=r"(cr4));
+    cr4 |= 0x80; // Global pages
+    asm volatile("mov %0, %%cr4":: "r"(cr4));
+  }
 }
 
 void os::Paging::switchDirectory(PageDirectory* dir) {
@@ -123,6 +179,9 @@ static void identity_map(uintptr_t start, uintptr_t end, bool rw = true, bool us
     if(!table_ref[pte].present) {
       table_ref[pte].present = 1;
       table_ref[pte].rw = 1;
+      // Identity mapped memory is the same in every directory, so its TLB
+      // entries can survive CR3 reloads
+      table_ref[pte].global = os::Cpu::has(os::Cpu::Feature::PGE) ? 1 : 0;
       table_ref[pte].addr = i / 0x1000;
     }
   }
@@ -143,7 +202,7 @@ void os::Paging::init(multiboot_memory_map_t* map, size_t mapLength) {
         heapStart = mmap->addr;
         if(heapStart & 0x00000FFF) {
           size_t tmp = heapStart;
-          heapStart &= 0x00000FFF;
+          heapStart &= 0xFFFFF000;
           heapStart += 0x1000;
           heapSize -= (heapStart - tmp);
         }
@@ -169,6 +228,24 @@ void os::Paging::init(multiboot_memory_map_t* map, size_t mapLength) {
 
   memoryMap = new os::bitset<>((heapSize - 1) / 0x1000 + 1);
 
+  for(size_t i = 0; i < vmalloc_tables; i++) {
+    auto& pde = (*kernel_directory)[vmalloc_first_table + i];
+    assert(!pde.present); // Physical memory reaching into the vmalloc range
+    PageTable* table = (PageTable*)kmalloc_align(sizeof(PageTable));
+    memset(table, 0, sizeof(PageTable));
+    pde.addr = (uintptr_t)table / 0x1000;
+    pde.present = 1;
+    pde.rw = 1;
+  }
+  vmallocMap = new os::bitset<>(vmalloc_size / 0x1000);
+
+  // Everything allocated before the heap (page tables, the bitmaps, the
+  // symbol index) sits right after the kernel, so the frames it spans must
+  // never be handed out. No placement allocation may happen after this.
+  for(uintptr_t addr = heapStart; addr < placement_address && addr < heapStart + heapSize; addr += 0x1000) {
+    memoryMap->set((addr - heapStart) >> 12);
+  }
+
   os::Interrupts::registerInterruptHandler(14, pageFaultHandler);
 
   loadPageDirectory(kernel_directory);
@@ -193,7 +270,8 @@ os::std::pair<uintptr_t, bool> os::Paging::translate(uintptr_t virtAddr) {
   return {0, false};
 }
 
-static uintptr_t allocPage() {
+// Must be called with spinlock held
+static uintptr_t globalAllocPage() {
   size_t frame = memoryMap->firstFree();
   if(frame == (size_t)-1) return 0;
   memoryMap->set(frame);
@@ -201,15 +279,119 @@ static uintptr_t allocPage() {
   return (uintptr_t)(heapStart + frame * 0x1000);
 }
 
-static void freePage(uintptr_t page) {
-  size_t frame = page >> 12;
+// Must be called with spinlock held
+static void globalFreePage(uintptr_t page) {
+  size_t frame = (page - heapStart) >> 12;
   memoryMap->unset(frame);
 }
 
+static uintptr_t allocPage() {
+  os::InterruptGuard guard;
+  FrameCache& cache = frameCaches.local();
+
+  if(cache.count == 0) {
+    os::scoped_lock l(spinlock);
+    while(cache.count < FrameCache::batch) {
+      uintptr_t page = globalAllocPage();
+      if(page == 0) break;
+      cache.frames[cache.count++] = page;
+    }
+    if(cache.count == 0) return 0;
+  }
+
+  return cache.frames[--cache.count];
+}
+
+static void freePage(uintptr_t page) {
+  os::InterruptGuard guard;
+  FrameCache& cache = frameCaches.local();
+
+  if(cache.count == FrameCache::capacity) {
+    os::scoped_lock l(spinlock);
+    while(cache.count > FrameCache::capacity - FrameCache::batch) {
+      globalFreePage(cache.frames[--cache.count]);
+    }
+  }
+
+  cache.frames[cache.count++] = page;
+}
+
+uintptr_t os::Paging::allocFrame() {
+  return allocPage();
+}
+
+void os::Paging::freeFrame(uintptr_t frame) {
+  assert(!(frame & 0xFFF));
+  freePage(frame);
+}
+
+// Frames cleared ahead of time by the idle task
+constexpr size_t zero_pool_size = 64;
+static uintptr_t zeroPool[zero_pool_size];
+static size_t zeroPoolCount = 0;
+
+static void zeroPage(uintptr_t page) {
+  if(!os::Cpu::has(os::Cpu::Feature::SSE2)) {
+    memset((void*)page, 0, 0x1000);
+    return;
+  }
+
+  // Non-temporal stores go around the cache, so clearing pages in the
+  // background doesn't evict the working set of the other tasks.
+  // MOVNTI only touches general purpose registers, no FPU state needed.
+  for(uintptr_t p = page; p < page + 0x1000; p += 16) {
+    asm volatile(
+      "movnti %1, 0(%0)\n\t"
+      "movnti %1, 4(%0)\n\t"
+      "movnti %1, 8(%0)\n\t"
+      "movnti %1, 12(%0)"
+      :: "r"(p), "r"(0) : "memory");
+  }
+  asm volatile("sfence" ::: "memory");
+}
+
+static uintptr_t allocZeroed() {
+  {
+    os::scoped_lock l(spinlock);
+    if(zeroPoolCount > 0) {
+      return zeroPool[--zeroPoolCount];
+    }
+  }
+
+  uintptr_t page = allocPage();
+  if(page != 0) memset((void*)page, 0, 0x1000);
+  return page;
+}
+
+uintptr_t os::Paging::allocZeroedPage() {
+  return allocZeroed();
+}
+
+bool os::Paging::refillZeroedPages() {
+  if(!heapActive()) return false;
+
+  spinlock.acquire();
+  bool full = zeroPoolCount >= zero_pool_size;
+  spinlock.release();
+  if(full) return false;
+
+  uintptr_t page = allocPage();
+  if(page == 0) return false;
+
+  // The frame is ours until it's in the pool, so it can be cleared unlocked
+  zeroPage(page);
+
+  spinlock.acquire();
+  full = zeroPoolCount >= zero_pool_size;
+  if(!full) zeroPool[zeroPoolCount++] = page;
+  spinlock.release();
+
+  if(full) freePage(page);
+  return true;
+}
+
 static PageDirectory* allocDirectory() {
-  PageDirectory* dir = (PageDirectory*)allocPage();
-  memset(dir, 0, sizeof(PageDirectory));
-  return dir;
+  return (PageDirectory*)allocZeroed();
 }
 
 static void freeDirectory(PageDirectory* dir) {
@@ -217,9 +399,7 @@ static void freeDirectory(PageDirectory* dir) {
 }
 
 static PageTable* allocTable() {
-  PageTable* table = (PageTable*)allocPage();
-  memset(table, 0, sizeof(PageTable));
-  return table;
+  return (PageTable*)allocZeroed();
 }
 
 static void freeTable(PageTable* table) {
@@ -234,11 +414,15 @@ struct HeapHeader {
 };
 
 void *malloc(size_t s) {
-  spinlock.acquire();
   size_t neededMemory = s + sizeof(HeapHeader);
   size_t numPages = (neededMemory - 1) / 0x1000 + 1;
+
+  spinlock.acquire();
   size_t addrSlot = memoryMap->freeSpan(numPages);
-  if(addrSlot == (size_t)-1) return nullptr;
+  if(addrSlot == (size_t)-1) {
+    spinlock.release();
+    return nullptr;
+  }
   for(size_t i = 0; i < numPages; i++) {
     memoryMap->set(addrSlot + i);
   }
@@ -325,6 +509,100 @@ void free(void* ptr) {
   spinlock.release();
 }
 
+static void* vmallocPages(size_t size, bool lazy) {
+  if(size == 0) return nullptr;
+  size_t pages = (size - 1) / 0x1000 + 1;
+
+  vmallocLock.acquire();
+  size_t first = vmallocMap->freeRun(pages);
+  if(first == (size_t)-1) {
+    vmallocLock.release();
+    return nullptr;
+  }
+  for(size_t i = 0; i < pages; i++) {
+    vmallocMap->set(first + i);
+  }
+  vmallocLock.release();
+
+  uintptr_t start = vmalloc_start + first * 0x1000;
+  for(size_t i = 0; i < pages; i++) {
+    auto& pte = vmallocEntry(start + i * 0x1000);
+    pte.rw = 1;
+    pte.available = i == pages - 1 ? vm_last : 0;
+
+    if(lazy) {
+      pte.available |= vm_lazy;
+      continue;
+    }
+
+    uintptr_t frame = allocPage();
+    if(frame == 0) {
+      // Give back the pages not reached yet, then free the rest as a
+      // shorter allocation
+      pte.available |= vm_last;
+      vmallocLock.acquire();
+      for(size_t j = i + 1; j < pages; j++) {
+        vmallocMap->unset(first + j);
+      }
+      vmallocLock.release();
+      vfree((void*)start);
+      return nullptr;
+    }
+    pte.addr = frame >> 12;
+    pte.present = 1;
+  }
+
+  return (void*)start;
+}
+
+static bool handleLazyFault(uintptr_t addr) {
+  if(!inVmallocRange(addr)) return false;
+
+  auto& pte = vmallocEntry(addr);
+  if(pte.present || !(pte.available & vm_lazy)) return false;
+
+  uintptr_t frame = allocZeroed();
+  if(frame == 0) panic("Out of memory for a lazily allocated page");
+  pte.addr = frame >> 12;
+  pte.available &= ~vm_lazy;
+  pte.present = 1;
+  invalidatePage(addr & 0xFFFFF000);
+  return true;
+}
+
+void* vmalloc(size_t size) {
+  return vmallocPages(size, false);
+}
+
+void* vmalloc_lazy(size_t size) {
+  return vmallocPages(size, true);
+}
+
+void vfree(void* ptr) {
+  if(ptr == nullptr) return;
+
+  uintptr_t start = (uintptr_t)ptr;
+  assert(inVmallocRange(start) && !(start & 0xFFF));
+
+  size_t pages = 0;
+  bool last = false;
+  while(!last) {
+    uintptr_t addr = start + pages * 0x1000;
+    auto& pte = vmallocEntry(addr);
+    last = pte.available & vm_last;
+    if(pte.present) freePage(pte.addr << 12);
+    pte = PageTableEntry{};
+    invalidatePage(addr);
+    pages++;
+  }
+
+  size_t first = (start - vmalloc_start) >> 12;
+  os::scoped_lock l(vmallocLock);
+  for(size_t i = 0; i < pages; i++) {
+    vmallocMap->unset(first + i);
+  }
+}
+
 size_t os::Paging::getHeapSize() {
   return heapSize;
 }
@@ -349,6 +627,7 @@ static PageDirectory* cloneDirectory(PageDirectory& dir) {
   for(int i = 0; i < 1024; i++) {
     if(dir[i].present) {
       clone[i] = dir[i];
+      if((size_t)i - vmalloc_first_table < vmalloc_tables) continue; // Shared
       PageTable* tbl = (PageTable*)(dir[i].addr << 12);
       clone[i].addr = (uintptr_t)cloneTable(tbl) >> 12;
     }
@@ -358,13 +637,9 @@ static PageDirectory* cloneDirectory(PageDirectory& dir) {
 }
 
 ThreadData os::Paging::makeThread() {
-  spinlock.acquire();
-  uintptr_t stackPage = allocPage();
-  memset((void*)stackPage, 0, 0x1000);
-
+  uintptr_t stackPage = allocZeroed();
   PageTable* stackTable = allocTable();
   PageDirectory* dir = cloneDirectory(*kernel_directory);
-  spinlock.release();
 
   auto& lastTableEntry = (*stackTable)[1023];
   lastTableEntry.addr = stackPage / 0x1000;
@@ -379,11 +654,24 @@ ThreadData os::Paging::makeThread() {
   return {dir, 0xFFFFFFFF, stackPage + 0xFFF};
 }
 
+ThreadData os::Paging::makeKernelThread() {
+  uintptr_t stackPage = allocZeroed();
+
+  return {kernel_directory, stackPage + 0xFFF, stackPage + 0xFFF};
+}
+
 void os::Paging::freeThread(const ThreadData& data) {
-  os::scoped_lock l(spinlock);
+  // The boot task (Task::create) runs on a stack it doesn't own
+  if(data.physicalStackStart == 0) return;
+
+  if(data.directory == kernel_directory) {
+    freePage(data.physicalStackStart & 0xFFFFF000);
+    return;
+  }
 
   auto& lastDirEntry = (*data.directory)[1023];
   PageTable* stackTable = (PageTable*)(lastDirEntry.addr << 12);
+  freePage(data.physicalStackStart & 0xFFFFF000);
   freeTable(stackTable);
   freeDirectory(data.directory);
 }
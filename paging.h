@@ -30,7 +30,7 @@ namespace os {
       uint32_t dirty         : 1;
       uint32_t zero          : 1;
       uint32_t global        : 1;
-      uint32_t unused        : 3;
+      uint32_t available     : 3; // Free for the kernel's use
       uint32_t addr          : 20;
     };
 
@@ -84,6 +84,14 @@ namespace os {
      * \return A pair of the new directory and a pointer to the beginning of the stack 
      */
     ThreadData makeThread();
+
+    /**
+     * \brief Allocates a stack page for a kernel thread, which runs in the
+     * kernel's page directory
+     *
+     * \return The kernel directory and the (identity mapped) beginning of the stack
+     */
+    ThreadData makeKernelThread();
     
     /**
      * \brief Deallocates the pages for a thread's stack
@@ -92,6 +100,42 @@ namespace os {
      */
     void freeThread(const ThreadData& data);
 
+    /**
+     * \brief Allocates a physical frame
+     *
+     * Served from a per-CPU cache refilled in batches, so it's lock-free most
+     * of the time and safe to call from interrupt handlers. Cached frames
+     * count as allocated in getFreeHeap().
+     *
+     * \return The frame's (identity mapped) address, 0 if out of memory
+     */
+    uintptr_t allocFrame();
+
+    /**
+     * \brief Returns a frame obtained from allocFrame or allocZeroedPage
+     */
+    void freeFrame(uintptr_t frame);
+
+    /**
+     * \brief Allocates a physical frame filled with zeroes
+     *
+     * Frames come from a pool cleared in the background by the idle task.
+     * When the pool is empty the frame is cleared on the spot.
+     *
+     * \return The frame's (identity mapped) address, 0 if out of memory
+     */
+    uintptr_t allocZeroedPage();
+
+    /**
+     * \brief Clears one more frame for the zeroed page pool
+     *
+     * Meant to be called when there's nothing better to do. Frames in the
+     * pool count as allocated in getFreeHeap().
+     *
+     * \return false if the pool is full or memory is exhausted
+     */
+    bool refillZeroedPages();
+
     /**
      * \brief Whether the heap is active or not
      */
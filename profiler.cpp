@@ -0,0 +1,232 @@
+#include "profiler.h"
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic.h>
+#include <percpu.h>
+#include <ring_buffer.h>
+#include <flat_hash_map.h>
+#include <vector.h>
+#include <pair.h>
+#include <algorithm.h>
+#include "synchro.h"
+#include "deferred.h"
+#include "reflection.h"
+#include "paging.h"
+#include "debug.h"
+
+// Innermost frame first, frames[0] is the interrupted EIP
+struct Sample {
+  static constexpr size_t max_depth = 16;
+
+  uintptr_t frames[max_depth];
+  uint32_t depth;
+};
+
+struct CpuSamples {
+  os::SpscRingBuffer<Sample, 256> ring;
+  // Samples lost because the ring was full
+  uint32_t dropped;
+  bool drainQueued;
+};
+
+// The same as Sample, but with every frame replaced by the start of its function
+struct Stack {
+  uintptr_t frames[Sample::max_depth];
+  uint32_t depth;
+};
+
+struct StackHash {
+  size_t operator()(const Stack& s) const {
+    uint32_t h = s.depth;
+    for(uint32_t i = 0; i < s.depth; i++) {
+      h = os::std::detail::mix32(h ^ s.frames[i]);
+    }
+    return h;
+  }
+};
+
+struct StackEqual {
+  bool operator()(const Stack& a, const Stack& b) const {
+    if(a.depth != b.depth) return false;
+    for(uint32_t i = 0; i < a.depth; i++) {
+      if(a.frames[i] != b.frames[i]) return false;
+    }
+    return true;
+  }
+};
+
+static os::std::atomic<bool> active;
+static os::PerCpu<CpuSamples> cpus;
+
+// Results, only touched with resultsLock held. The worker task that drains
+// the rings runs at a higher priority than whoever prints a report, so it
+// must never spin on the lock: it would never let the holder release it.
+static os::Spinlock resultsLock;
+static os::flat_hash_map<uintptr_t, uint32_t> functionCounts;
+static os::flat_hash_map<Stack, uint32_t, StackHash, StackEqual> stackCounts;
+static uint32_t totalSamples = 0;
+
+static bool isMapped(uintptr_t addr) {
+  return os::Paging::translate(addr).second;
+}
+
+// Follows the saved EBP chain. Frames live on the interrupted task's stack
+// and get further up with every caller, anything else ends the walk.
+static void walkStack(Sample& s, uintptr_t ebp) {
+  uintptr_t mappedPage = 0;
+  while(s.depth < Sample::max_depth && ebp != 0 && (ebp & 3) == 0) {
+    uintptr_t page = ebp & 0xFFFFF000;
+    if(page != mappedPage) {
+      // A frame may straddle two pages
+      if(!isMapped(ebp) || !isMapped(ebp + 4)) break;
+      mappedPage = page;
+    }
+
+    const uintptr_t* frame = (const uintptr_t*)ebp;
+    uintptr_t ret = frame[1];
+    if(ret == 0) break;
+    s.frames[s.depth++] = ret;
+
+    uintptr_t next = frame[0];
+    if(next <= ebp) break;
+    ebp = next;
+  }
+}
+
+static uintptr_t functionOf(uintptr_t addr) {
+  auto sym = os::Reflection::getSymbolName(addr);
+  return addr - sym.second;
+}
+
+static void collect(CpuSamples& cpu) {
+  Sample batch[8];
+  size_t n;
+  while((n = cpu.ring.pop(batch, 8)) > 0) {
+    for(size_t i = 0; i < n; i++) {
+      Stack stack;
+      stack.depth = batch[i].depth;
+      stack.frames[0] = functionOf(batch[i].frames[0]);
+      // Return addresses point after the call, which may be the first byte
+      // of the next function
+      for(uint32_t j = 1; j < stack.depth; j++) {
+        stack.frames[j] = functionOf(batch[i].frames[j] - 1);
+      }
+
+      functionCounts[stack.frames[0]]++;
+      stackCounts[stack]++;
+      totalSamples++;
+    }
+  }
+}
+
+static void drain(void* data) {
+  CpuSamples& cpu = *static_cast<CpuSamples*>(data);
+  cpu.drainQueued = false;
+  // Busy means a report is collecting the samples anyway, otherwise the next
+  // tick queues another drain
+  if(!resultsLock.try_acquire()) return;
+  collect(cpu);
+  resultsLock.release();
+}
+
+static void drainAll() {
+  os::scoped_lock<os::Spinlock> lock(resultsLock);
+  for(size_t i = 0; i < cpus.size(); i++) {
+    collect(cpus[i]);
+  }
+}
+
+void os::Profiler::start() {
+  stop();
+
+  {
+    os::scoped_lock<os::Spinlock> lock(resultsLock);
+    functionCounts.clear();
+    stackCounts.clear();
+    totalSamples = 0;
+    for(size_t i = 0; i < cpus.size(); i++) {
+      cpus[i].dropped = 0;
+    }
+  }
+
+  active.store(true, os::std::memory_order_release);
+}
+
+void os::Profiler::stop() {
+  active.store(false, os::std::memory_order_release);
+  drainAll();
+}
+
+bool os::Profiler::running() {
+  return active.load(os::std::memory_order_relaxed);
+}
+
+void os::Profiler::sample(const os::Interrupts::Registers* regs) {
+  if(!active.load(os::std::memory_order_relaxed)) return;
+
+  Sample s;
+  s.frames[0] = regs->eip;
+  s.depth = 1;
+  // Only kernel stacks can be walked
+  if((regs->cs & 3) == 0) {
+    walkStack(s, regs->pusha_registers.ebp);
+  }
+
+  auto& cpu = cpus.local();
+  if(!cpu.ring.push(s)) {
+    cpu.dropped++;
+  }
+
+  // Symbolizing and counting is left to this CPU's worker task
+  if(!cpu.drainQueued && cpu.ring.size() >= cpu.ring.capacity() / 2) {
+    cpu.drainQueued = os::Deferred::queue_work(&drain, &cpu);
+  }
+}
+
+static const char* nameOf(uintptr_t function) {
+  const char* name = os::Reflection::getSymbolName(function).first;
+  return *name ? name : "[unknown]";
+}
+
+void os::Profiler::report(size_t maxFunctions) {
+  drainAll();
+  os::scoped_lock<os::Spinlock> lock(resultsLock);
+
+  uint32_t dropped = 0;
+  for(size_t i = 0; i < cpus.size(); i++) {
+    dropped += cpus[i].dropped;
+  }
+  debug_print("Profile: % samples, % dropped\n", totalSamples, dropped);
+  if(totalSamples == 0) return;
+
+  os::std::vector<os::std::pair<uintptr_t, uint32_t>> functions;
+  functions.reserve(functionCounts.size());
+  for(auto& entry : functionCounts) {
+    functions.push_back({entry.first, entry.second});
+  }
+  os::std::sort(functions.begin(), functions.end(), [](const auto& a, const auto& b) {
+    return a.second > b.second;
+  });
+
+  for(size_t i = 0; i < functions.size() && i < maxFunctions; i++) {
+    uint32_t count = functions[i].second;
+    uint32_t tenths = count * 1000 / totalSamples;
+    debug_print("  % %.%", count, tenths / 10, tenths % 10);
+    debug_print("%%  % (%)\n", nameOf(functions[i].first), (const void*)functions[i].first);
+  }
+}
+
+void os::Profiler::dumpCollapsed() {
+  drainAll();
+  os::scoped_lock<os::Spinlock> lock(resultsLock);
+
+  for(auto& entry : stackCounts) {
+    const Stack& stack = entry.first;
+    for(uint32_t i = stack.depth; i-- > 0;) {
+      debug_write(nameOf(stack.frames[i]));
+      if(i > 0) debug_put(';');
+    }
+    debug_print(" %\n", entry.second);
+  }
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stddef.h>
+#include "interrupts.h"
+
+namespace os {
+  // Statistical profiler driven by the timer interrupt. Each tick records the
+  // interrupted EIP and a few return addresses from the EBP chain into a
+  // per-CPU ring; the samples are symbolized and counted later, in task
+  // context. The sampling rate is the timer frequency.
+  namespace Profiler {
+    /**
+     * \brief Discards the previous results and starts sampling
+     *
+     * Must be called after Deferred::init
+     */
+    void start();
+
+    /**
+     * \brief Stops sampling and folds the pending samples into the results
+     */
+    void stop();
+
+    bool running();
+
+    /**
+     * \brief Records a sample of the interrupted context, called by the
+     * timer interrupt handler
+     *
+     * Does nothing unless the profiler is running.
+     */
+    void sample(const os::Interrupts::Registers* regs);
+
+    /**
+     * \brief Prints the functions with the most samples on the debug port
+     *
+     * \param maxFunctions How many functions to list
+     */
+    void report(size_t maxFunctions = 20);
+
+    /**
+     * \brief Prints every sampled stack on the debug port in the collapsed
+     * format of flamegraph.pl, one `outer;...;inner count` line per stack
+     */
+    void dumpCollapsed();
+  }
+}
@@ -1,12 +1,23 @@
 #include "reflection.h"
+#include "kheap.h"
 #include <kassert.h>
 #include <stddef.h>
+#include <string.h>
+#include <algorithm.h>
+#include <function_objects.h>
 
 #define SHF_WRITE              0x1
 #define SHF_ALLOC              0x2
 #define SHF_EXECINSTR          0x4
 #define SHF_MASKPROC    0xf0000000
 
+#define SHN_UNDEF       0
+#define SHN_LORESERVE   0xff00
+
+#define ELF32_ST_TYPE(i) ((i) & 0xf)
+#define STT_NOTYPE      0
+#define STT_FUNC        2
+
 enum class SectionType : uint32_t {
   SHT_NULL = 0,
   SHT_PROGBITS = 1,
@@ -63,6 +74,78 @@ static const char* shstrtab = nullptr;
 static uintptr_t kernelStart = (uintptr_t)-1;
 static uintptr_t kernelEnd = 0;
 
+// Code symbols sorted by address. Only what a lookup needs is kept, the
+// name is an offset into strtab.
+struct Symbol {
+  uintptr_t address;
+  uint32_t size;
+  uint32_t name;
+};
+
+// The same symbols sorted by the hash of their name, for reverse lookups
+struct NameEntry {
+  uint32_t hash;
+  uint32_t symbol;
+};
+
+static Symbol* symbols = nullptr;
+static size_t symbolCount = 0;
+static NameEntry* names = nullptr;
+
+static bool isCode(const Elf32_Sym& sym, multiboot_elf_section_header_table_t elf) {
+  uint8_t type = ELF32_ST_TYPE(sym.st_info);
+  // Labels from assembly files have no type
+  if(type != STT_FUNC && type != STT_NOTYPE) return false;
+  if(sym.st_value == 0 || sym.st_name == 0) return false;
+  if(sym.st_shndx == SHN_UNDEF || sym.st_shndx >= SHN_LORESERVE || sym.st_shndx >= elf.num) return false;
+  return headers[sym.st_shndx].sh_flags & SHF_EXECINSTR;
+}
+
+static uint32_t hashName(const char* name) {
+  return os::std::cstring_hash()(name);
+}
+
+static void buildIndex(multiboot_elf_section_header_table_t elf) {
+  size_t count = 0;
+  for(size_t i = 0; i < symtab_entries; i++) {
+    if(isCode(symtab[i], elf)) count++;
+  }
+  if(count == 0) return;
+
+  // The heap doesn't exist yet, this comes from the placement allocator
+  symbols = (Symbol*)kmalloc(count * sizeof(Symbol));
+  size_t n = 0;
+  for(size_t i = 0; i < symtab_entries; i++) {
+    if(isCode(symtab[i], elf)) {
+      symbols[n++] = {symtab[i].st_value, symtab[i].st_size, symtab[i].st_name};
+    }
+  }
+
+  os::std::sort(symbols, symbols + n, [](const Symbol& a, const Symbol& b) {
+    if(a.address != b.address) return a.address < b.address;
+    return a.size < b.size;
+  });
+
+  // Aliases share an address, keep the one with the largest size
+  size_t unique = 0;
+  for(size_t i = 0; i < n; i++) {
+    if(unique > 0 && symbols[unique - 1].address == symbols[i].address) {
+      symbols[unique - 1] = symbols[i];
+    } else {
+      symbols[unique++] = symbols[i];
+    }
+  }
+  symbolCount = unique;
+
+  names = (NameEntry*)kmalloc(symbolCount * sizeof(NameEntry));
+  for(size_t i = 0; i < symbolCount; i++) {
+    names[i] = {hashName(&strtab[symbols[i].name]), i};
+  }
+  os::std::sort(names, names + symbolCount, [](const NameEntry& a, const NameEntry& b) {
+    return a.hash < b.hash;
+  });
+}
+
 void os::Reflection::init(multiboot_elf_section_header_table_t elf) {
   Elf32_Shdr* hdrs = (Elf32_Shdr*)elf.addr;
   headers = hdrs;
@@ -95,6 +178,14 @@ void os::Reflection::init(multiboot_elf_section_header_table_t elf) {
 
   symtab = (Elf32_Sym*)symtab_hdr->sh_addr;
   strtab = (const char*)strtab_hdr->sh_addr;
+
+  // GRUB loads the symbol and string tables after the end of the image, make
+  // sure early allocations don't overwrite them
+  if(placement_address < kernelEnd) {
+    placement_address = kernelEnd;
+  }
+
+  buildIndex(elf);
 }
 
 uintptr_t os::Reflection::getKernelEnd() {
@@ -106,24 +197,29 @@ uintptr_t os::Reflection::getKernelStart() {
 }
 
 os::std::pair<const char*, size_t> os::Reflection::getSymbolName(uintptr_t addr) {
-  if(strtab_hdr == nullptr) return {"", 0};
+  if(symbolCount == 0) return {"", 0};
+
+  // The last symbol starting at or before addr
+  const Symbol* it = os::std::upper_bound(symbols, symbols + symbolCount, addr,
+    [](uintptr_t a, const Symbol& sym) { return a < sym.address; });
+  if(it == symbols) return {"", 0};
+
+  const Symbol& sym = *(it - 1);
+  // Past the end of the symbol, in padding or code without a symbol. Some
+  // assembly symbols have no size and match up to the next one.
+  if(sym.size != 0 && addr - sym.address >= sym.size) return {"", 0};
+  return {&strtab[sym.name], addr - sym.address};
+}
 
-  uintptr_t actual_addr = 0;
-  size_t idx = -1;
+uintptr_t os::Reflection::getSymbolAddress(const char* name) {
+  if(symbolCount == 0) return 0;
 
-  // We are searching for the largest address that's smaller than the target
-  for(size_t i = 0; i < symtab_entries; i++) {
-    if(symtab[i].st_value < addr && symtab[i].st_value > actual_addr) {
-      idx = i;
-      actual_addr = symtab[i].st_value;
-    }
+  uint32_t hash = hashName(name);
+  const NameEntry* it = os::std::lower_bound(names, names + symbolCount, hash,
+    [](const NameEntry& e, uint32_t h) { return e.hash < h; });
+  for(; it != names + symbolCount && it->hash == hash; ++it) {
+    const Symbol& sym = symbols[it->symbol];
+    if(strcmp(&strtab[sym.name], name) == 0) return sym.address;
   }
-
-  if(idx == (size_t)-1)
-    return {"", 0};
-
-  Elf32_Sym sym = symtab[idx];
-  const char* name = &strtab[sym.st_name];
-  
-  return {name, addr - sym.st_value};
-}
\ No newline at end of file
+  return 0;
+}
@@ -15,12 +15,26 @@ namespace os {
 
     /**
      * \brief Returns the name of the symbol at address \p addr
+     *
+     * Only code symbols are indexed. The lookup is a binary search over a
+     * table built by init(), it doesn't allocate and is safe to call from
+     * interrupt handlers.
+     *
+     * An address outside of every symbol gives an empty name.
      * 
      * \param addr The address of the symbol
      * \return A pair containing the name of the symbol and the offset after the beginning of it
      */
     std::pair<const char*, size_t> getSymbolName(uintptr_t addr);
 
+    /**
+     * \brief Returns the address of the code symbol called \p name
+     *
+     * \param name The (mangled) name of the symbol
+     * \return The address of the symbol, or 0 if there is none
+     */
+    uintptr_t getSymbolAddress(const char* name);
+
     uintptr_t getKernelStart();
     uintptr_t getKernelEnd();
   }
@@ -0,0 +1,178 @@
+#include "sched_trace.h"
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic.h>
+#include <div64.h>
+#include <percpu.h>
+#include <ring_buffer.h>
+#include <flat_hash_map.h>
+#include "synchro.h"
+#include "cpu.h"
+#include "debug.h"
+
+using os::SchedTrace::EventKind;
+
+struct Event {
+  uint64_t timestamp;
+  uint32_t task;
+  EventKind kind;
+  uint8_t staticPriority;
+  uint8_t dynamicPriority;
+};
+
+struct CpuTrace {
+  os::SpscRingBuffer<Event, 4096> ring;
+  // Events lost because the ring was full
+  uint32_t dropped;
+};
+
+static os::std::atomic<bool> active;
+static os::PerCpu<CpuTrace> cpus;
+static uint64_t traceStart = 0;
+
+void os::SchedTrace::record(EventKind kind, uint32_t task, uint8_t staticPriority, uint8_t dynamicPriority) {
+  if(!active.load(os::std::memory_order_relaxed)) return;
+
+  // Some tracepoints run with interrupts enabled, an interrupt recording an
+  // event in the middle of this push would make a second producer
+  os::InterruptGuard guard;
+  auto& cpu = cpus.local();
+  if(!cpu.ring.push({os::Cpu::timestamp(), task, kind, staticPriority, dynamicPriority})) {
+    cpu.dropped++;
+  }
+}
+
+static void discard(CpuTrace& cpu) {
+  Event batch[16];
+  while(cpu.ring.pop(batch, 16) > 0) {;}
+  cpu.dropped = 0;
+}
+
+void os::SchedTrace::start() {
+  stop();
+  for(size_t i = 0; i < cpus.size(); i++) {
+    discard(cpus[i]);
+  }
+  traceStart = os::Cpu::timestamp();
+  active.store(true, os::std::memory_order_release);
+}
+
+void os::SchedTrace::stop() {
+  active.store(false, os::std::memory_order_release);
+}
+
+static const char* nameOf(EventKind kind) {
+  switch(kind) {
+    case EventKind::SwitchIn: return "switch_in";
+    case EventKind::SwitchOut: return "switch_out";
+    case EventKind::Wake: return "wake";
+    case EventKind::Block: return "block";
+    case EventKind::Enqueue: return "enqueue";
+    default: return "preempt";
+  }
+}
+
+// What the dump knows about a task so far
+struct Track {
+  bool running;
+  bool ready;
+  uint64_t readySince;
+};
+
+static bool firstEvent;
+
+// Chrome traces count in microseconds, with decimals for anything finer
+static void writeTime(uint64_t ticks) {
+  uint64_t ns = os::div64(ticks * 1'000'000, os::Cpu::timestampKhz());
+  uint32_t rem;
+  uint32_t us = (uint32_t)os::div64(ns, 1000, &rem);
+  debug_print("%.", us);
+  debug_put('0' + rem / 100);
+  debug_put('0' + rem / 10 % 10);
+  debug_put('0' + rem % 10);
+}
+
+static void beginEvent(const char* name, const char* phase, size_t cpu, const Event& e, uint64_t ts) {
+  debug_write(firstEvent ? "  " : ",\n  ");
+  firstEvent = false;
+  debug_print("{\"name\":\"%\",\"ph\":\"%\",\"pid\":%,\"tid\":%,\"ts\":", name, phase, (uint32_t)cpu, e.task);
+  writeTime(ts - traceStart);
+}
+
+static void endEvent(const Event& e) {
+  debug_print(",\"args\":{\"priority\":%,\"dynamic_priority\":%}}",
+    (uint32_t)e.staticPriority, (uint32_t)e.dynamicPriority);
+}
+
+void os::SchedTrace::dump() {
+  stop();
+
+  uint32_t dropped = 0;
+  for(size_t i = 0; i < cpus.size(); i++) {
+    dropped += cpus[i].dropped;
+  }
+
+  firstEvent = true;
+  debug_write("{\"traceEvents\":[\n");
+
+  for(size_t cpu = 0; cpu < cpus.size(); cpu++) {
+    os::flat_hash_map<uint32_t, Track> tracks;
+
+    Event batch[16];
+    size_t n;
+    while((n = cpus[cpu].ring.pop(batch, 16)) > 0) {
+      for(size_t i = 0; i < n; i++) {
+        const Event& e = batch[i];
+        auto inserted = tracks.emplace(e.task);
+        Track& track = inserted.first->second;
+        if(inserted.second) {
+          debug_write(firstEvent ? "  " : ",\n  ");
+          firstEvent = false;
+          debug_print("{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%,\"tid\":%,\"args\":{\"name\":\"task %\"}}",
+            (uint32_t)cpu, e.task, e.task);
+        }
+
+        switch(e.kind) {
+          case EventKind::SwitchIn:
+            // Scheduling latency, from becoming ready to running
+            if(track.ready) {
+              beginEvent("ready", "X", cpu, e, track.readySince);
+              debug_write(",\"dur\":");
+              writeTime(e.timestamp - track.readySince);
+              endEvent(e);
+              track.ready = false;
+            }
+            beginEvent("running", "B", cpu, e, e.timestamp);
+            endEvent(e);
+            track.running = true;
+            break;
+
+          case EventKind::SwitchOut:
+            // A slice that started before the trace has no beginning
+            if(track.running) {
+              beginEvent("running", "E", cpu, e, e.timestamp);
+              debug_write("}");
+              track.running = false;
+            }
+            break;
+
+          case EventKind::Wake:
+          case EventKind::Enqueue:
+            if(!track.ready) {
+              track.ready = true;
+              track.readySince = e.timestamp;
+            }
+            [[fallthrough]];
+          default:
+            beginEvent(nameOf(e.kind), "i", cpu, e, e.timestamp);
+            debug_write(",\"s\":\"t\"");
+            endEvent(e);
+            break;
+        }
+      }
+    }
+  }
+
+  debug_print("\n],\"displayTimeUnit\":\"ns\",\"otherData\":{\"dropped\":%}}\n", dropped);
+}
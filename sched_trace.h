@@ -0,0 +1,62 @@
+#pragma once
+
+#include <stdint.h>
+
+// Scheduler tracepoints. With CONFIG_SCHED_TRACE (make SCHED_TRACE=1) each
+// one records the task's id and priorities with a timestamp into a per-CPU
+// ring; otherwise they expand to nothing and their arguments are not even
+// evaluated.
+#ifdef CONFIG_SCHED_TRACE
+#define SCHED_TRACE(kind, task) \
+  os::SchedTrace::record(os::SchedTrace::EventKind::kind, (task)->id(), \
+                         static_cast<uint8_t>((task)->static_priority()), (task)->dynamic_priority())
+#else
+#define SCHED_TRACE(kind, task) ((void)0)
+#endif
+
+namespace os {
+  namespace SchedTrace {
+    enum class EventKind : uint8_t {
+      // The task got the CPU
+      SwitchIn,
+      // The task lost the CPU
+      SwitchOut,
+      // A waiting task was made ready
+      Wake,
+      // The running task started waiting
+      Block,
+      // The task was put in (or moved within) a ready queue
+      Enqueue,
+      // The running task used up its timeslice
+      Preempt
+    };
+
+    /**
+     * \brief Records an event, use the SCHED_TRACE macro instead
+     *
+     * Safe to call from interrupt handlers.
+     */
+    void record(EventKind kind, uint32_t task, uint8_t staticPriority, uint8_t dynamicPriority);
+
+    /**
+     * \brief Discards the previous trace and starts recording
+     */
+    void start();
+
+    /**
+     * \brief Stops recording, what was recorded is kept until dumped
+     */
+    void stop();
+
+    /**
+     * \brief Prints the recorded events on the debug port as a Chrome trace
+     * (JSON object format), which chrome://tracing and Perfetto can open
+     *
+     * Every task gets its own track, showing when it ran and, as "ready"
+     * slices, how long it waited in a ready queue before getting the CPU.
+     * The other events are instants on the task's track. Stops tracing and
+     * consumes the recorded events.
+     */
+    void dump();
+  }
+}
@@ -7,6 +7,25 @@ void os::Spinlock::acquire() {
   spinlock_acquire(&m_val);
 }
 
+bool os::Spinlock::try_acquire() {
+  int v = 1;
+  asm volatile("xchg %0, %1" : "+r"(v), "+m"(m_val) :: "memory");
+  return v == 0;
+}
+
 void os::Spinlock::release() {
   spinlock_release(&m_val);
+}
+
+void os::IrqSpinlock::acquire() {
+  uint32_t flags;
+  asm volatile("pushf; pop %0; cli" : "=r"(flags) :: "memory");
+  m_lock.acquire();
+  m_flags = flags;
+}
+
+void os::IrqSpinlock::release() {
+  uint32_t flags = m_flags;
+  m_lock.release();
+  asm volatile("push %0; popf" :: "r"(flags) : "memory", "cc");
 }
\ No newline at end of file
@@ -1,14 +1,48 @@
 #pragma once
 
+#include <stdint.h>
+
 namespace os {
   class Spinlock {
   public:
     void acquire();
+    // Takes the lock if it is free, never spins
+    bool try_acquire();
     void release();
   private:
     volatile int m_val = 0;
   };
 
+  // Disables interrupts on the local CPU for its lifetime, then restores
+  // whatever state they were in
+  class InterruptGuard {
+  public:
+    InterruptGuard() {
+      asm volatile("pushf; pop %0; cli" : "=r"(m_flags) :: "memory");
+    }
+
+    ~InterruptGuard() {
+      asm volatile("push %0; popf" :: "r"(m_flags) : "memory", "cc");
+    }
+
+    InterruptGuard(const InterruptGuard&) = delete;
+    InterruptGuard& operator=(const InterruptGuard&) = delete;
+
+  private:
+    uint32_t m_flags;
+  };
+
+  // A spinlock that also disables local interrupts while held, so that it
+  // can be shared between tasks and interrupt handlers
+  class IrqSpinlock {
+  public:
+    void acquire();
+    void release();
+  private:
+    Spinlock m_lock;
+    uint32_t m_flags = 0;
+  };
+
   template<typename T>
   class scoped_lock {
   public:
@@ -5,8 +5,13 @@
 #include <array.h>
 #include <kassert.h>
 #include <priority_queue.h>
+#include <flat_hash_map.h>
 #include "interrupts.h"
 #include "paging.h"
+#include "fpu.h"
+#include "synchro.h"
+#include "deferred.h"
+#include "sched_trace.h"
 
 #include "debug.h"
 
@@ -65,22 +70,56 @@ namespace os {
 
 extern "C" void task_switch(TaskInfo* current, TaskInfo* next);
 
-void task_switch_wrapper(TaskInfo* current, TaskInfo* next) {
-  if(sched_postponed_counter == 0) {
-    task_switch(current, next);
-  } else {
-    sched_postponed = true;
+namespace os {
+  namespace Tasking {
+    void task_switch_wrapper(Task* current, Task* next) {
+      assert(sched_postponed_counter == 0);
+      SCHED_TRACE(SwitchOut, current);
+      SCHED_TRACE(SwitchIn, next);
+      os::Fpu::switchTo(&next->m_info.fpu);
+      // A softirq may be what switches tasks, its flag must not follow us.
+      // The same goes for how often the scheduler is locked: every task
+      // unlocks it as often as it locked it, new tasks start with it locked
+      // once.
+      bool in_softirq = os::Deferred::save_softirq_state();
+      size_t disable_counter = sched_disable_counter;
+      sched_disable_counter = 1;
+      task_switch(&current->m_info, &next->m_info);
+      sched_disable_counter = disable_counter;
+      os::Deferred::restore_softirq_state(in_softirq);
+    }
   }
 }
 
-using task_ref = os::std::shared_ptr<Task>;
+struct os::Tasking::TaskQueueIndex {
+  size_t& operator()(const task_ref& t) const {
+    return t->m_queue_index;
+  }
+};
+
+// Indexed, so that a queued task whose priority changed can be moved in place
+using ready_queue = os::indexed_priority_queue<task_ref, TaskQueueIndex>;
+
+static ready_queue critical_tasks;
+static ready_queue realtime_tasks;
+static ready_queue normal_tasks;
+static ready_queue background_tasks;
+
+static task_ref current_task = nullptr;
 
-static os::std::priority_queue<task_ref> critical_tasks;
-static os::std::priority_queue<task_ref> realtime_tasks;
-static os::std::priority_queue<task_ref> normal_tasks;
-static os::std::priority_queue<task_ref> background_tasks;
+// The task switched away from last. If it ended this is its last reference,
+// which can't be dropped while its stack is still in use.
+static task_ref previous_task = nullptr;
 
-static task_ref current_task = nullptr, next_task = nullptr;
+// Every live task by id, not owning: tasks remove themselves when destroyed.
+// Protected by the scheduler lock.
+static os::flat_hash_map<uint32_t, Task*> tasks_by_id;
+
+static void register_task(Task* t) {
+  lock_scheduler();
+  tasks_by_id.insert(t->id(), t);
+  unlock_scheduler();
+}
 
 static bool operator<(TaskPriority a, TaskPriority b) {
   switch(a) {
@@ -104,36 +143,60 @@ static bool operator>=(TaskPriority a, TaskPriority b) {
 }
 
 static void idle_task() {
-  while(true) { asm volatile("hlt"); }
+  os::Tasking::unlock_scheduler();
+  while(true) {
+    // Spend idle time clearing pages for the allocation paths, sleep once
+    // the pool is full
+    if(!os::Paging::refillZeroedPages()) asm volatile("hlt");
+  }
 }
 
 static void end_task() {
   current_task->end();
 }
 
-static void enqueue_task(task_ref& t) {
+static ready_queue& queue_for(TaskPriority priority) {
+  switch(priority) {
+    case TaskPriority::Critical: return critical_tasks;
+    case TaskPriority::RealTime: return realtime_tasks;
+    case TaskPriority::Normal: return normal_tasks;
+    default: return background_tasks;
+  }
+}
+
+static void enqueue_task(const task_ref& t) {
   assert(t->state() == TaskState::Ready);
-  switch(t->static_priority()) {
-    case TaskPriority::Critical:
-      critical_tasks.push(t); break;
-    case TaskPriority::RealTime:
-      realtime_tasks.push(t); break;
-    case TaskPriority::Normal:
-      normal_tasks.push(t); break;
-    case TaskPriority::Background:
-      background_tasks.push(t); break;
+  auto& queue = queue_for(t->static_priority());
+  SCHED_TRACE(Enqueue, t);
+  if(queue.contains(t)) {
+    queue.update(t);
+  } else {
+    queue.push(t);
+  }
+}
+
+static os::Paging::ThreadData make_context(TaskKind kind) {
+  if(kind == TaskKind::KernelThread) {
+    return os::Paging::makeKernelThread();
   }
+  return os::Paging::makeThread();
 }
 
-task_ref Task::start(Task::function_type* func, TaskPriority priority) {
-  auto ref = std::shared_ptr(new Task());
+task_ref Task::start(Task::function_type* func, TaskPriority priority, TaskKind kind) {
+  task_ref ref = new Task();
   ref->m_spriority = priority;
   ref->m_dpriority = 0;
   ref->m_state = Tasking::TaskState::Ready;
   ref->m_id = maxid++;
+  register_task(ref.get());
 
-  auto context = os::Paging::makeThread();
-  uint32_t* stack = (uint32_t*)context.physicalStackStart;
+  auto context = make_context(kind);
+
+  // The stack page is written through its physical (identity mapped)
+  // address. func is entered as if called from a 16 byte aligned stack.
+  uintptr_t physicalPage = context.physicalStackStart & 0xFFFFF000;
+  uintptr_t virtualPage = context.virtualStackStart & 0xFFFFF000;
+  uint32_t* stack = (uint32_t*)(physicalPage + 0x1000);
   stack--;
   *stack = (uintptr_t)&end_task;
   stack--;
@@ -148,7 +211,7 @@ task_ref Task::start(Task::function_type* func, TaskPriority priority) {
   *stack = 0; // ebp
 
   ref->m_info.data = context;
-  ref->m_info.esp = context.virtualStackStart - 4 * 6;
+  ref->m_info.esp = virtualPage + ((uintptr_t)stack - physicalPage);
 
   //lock_scheduler();
   enqueue_task(ref);
@@ -157,23 +220,96 @@ task_ref Task::start(Task::function_type* func, TaskPriority priority) {
   return ref;
 }
 
+task_ref Task::start_frame(frame_entry* entry, size_t size, size_t align,
+                           frame_constructor* construct, void* src, TaskPriority priority,
+                           TaskKind kind) {
+  task_ref ref = new Task();
+  ref->m_spriority = priority;
+  ref->m_dpriority = 0;
+  ref->m_state = Tasking::TaskState::Ready;
+  ref->m_id = maxid++;
+  register_task(ref.get());
+
+  auto context = make_context(kind);
+
+  // The stack page is reachable both through its physical (identity mapped)
+  // address and through the task's own virtual mapping, which is the same
+  // address for kernel threads
+  uintptr_t physicalPage = context.physicalStackStart & 0xFFFFF000;
+  uintptr_t virtualPage = context.virtualStackStart & 0xFFFFF000;
+  uintptr_t frameOffset = (0x1000 - size) & ~(align - 1);
+  construct((void*)(physicalPage + frameOffset), src);
+
+  // entry's argument starts on a 16 byte boundary, as after a call
+  uintptr_t argumentOffset = (frameOffset - 4) & ~(uintptr_t)15;
+  uint32_t* stack = (uint32_t*)(physicalPage + argumentOffset + 4);
+  stack--;
+  *stack = virtualPage + frameOffset; // entry's argument
+  stack--;
+  *stack = (uintptr_t)&end_task;
+  stack--;
+  *stack = (uintptr_t)entry;
+  stack--;
+  *stack = 0; // ebx
+  stack--;
+  *stack = 0; // esi
+  stack--;
+  *stack = 0; // edi
+  stack--;
+  *stack = 0; // ebp
+
+  ref->m_info.data = context;
+  ref->m_info.esp = virtualPage + ((uintptr_t)stack - physicalPage);
+
+  enqueue_task(ref);
+
+  return ref;
+}
+
 task_ref Task::create() {
-  auto ref = os::std::shared_ptr(new Task());
+  task_ref ref = new Task();
   ref->m_spriority = TaskPriority::Normal;
   ref->m_dpriority = 0;
   ref->m_state = TaskState::Running;
   ref->m_id = 0;
+  register_task(ref.get());
   ref->m_info.data.directory = os::Paging::currentDirectory();
+  // The running thread's FPU state now belongs to this task
+  os::Fpu::adopt(&ref->m_info.fpu);
+
+  return ref;
+}
+
+task_ref Task::current() {
+  return current_task;
+}
 
+task_ref Task::find(uint32_t id) {
+  lock_scheduler();
+  Task** t = tasks_by_id.get(id);
+  // A task stays in the map until its destructor runs, after the last
+  // reference was dropped
+  task_ref ref;
+  if(t != nullptr && intrusive_ptr_try_add_ref(*t)) ref = task_ref(*t, false);
+  unlock_scheduler();
   return ref;
 }
 
+Task::~Task() {
+  lock_scheduler();
+  tasks_by_id.erase(m_id);
+  unlock_scheduler();
+
+  os::Fpu::release(&m_info.fpu);
+  os::Paging::freeThread(m_info.data);
+}
+
 void os::Tasking::init() {
   // Create metadata for currently running thread
   current_task = Task::create();
 
   // Create an idle task with lowest priority that never waits
-  Task::start(&idle_task, TaskPriority::Background);
+  Task::start(&idle_task, TaskPriority::Background, TaskKind::KernelThread);
 }
 
 void Waitable::wait() {
@@ -183,6 +319,7 @@ void Waitable::wait() {
   if(!m_ready) {
     current_task->m_state = TaskState::Waiting;
     current_task->increase_dynamic_priority();
+    SCHED_TRACE(Block, current_task);
     m_wait_list.push_back(current_task);
     os::Tasking::schedule();
   }
@@ -199,53 +336,85 @@ static bool should_preempt(TaskPriority cur_s, uint8_t cur_d, TaskPriority next_
 }
 
 void Waitable::finish() {
+  lock_scheduler();
+  signal();
+  os::Tasking::schedule();
+  unlock_scheduler();
+}
+
+void Waitable::signal() {
   lock_scheduler();
   m_ready = true;
   for(auto& task : m_wait_list) {
     assert(task->state() == TaskState::Waiting);
     task->set_state(TaskState::Ready);
+    SCHED_TRACE(Wake, task);
     enqueue_task(task);
   }
+  m_wait_list.clear();
+
+  Waiter* w = m_waiters;
+  m_waiters = nullptr;
+  while(w != nullptr) {
+    Waiter* next = w->next_waiter;
+    w->next_waiter = nullptr;
+    w->notify();
+    w = next;
+  }
 
-  os::Tasking::schedule();
   unlock_scheduler();
 }
 
+bool Waitable::add_waiter(Waiter& w) {
+  lock_scheduler();
+  bool registered = !m_ready;
+  if(registered) {
+    w.next_waiter = m_waiters;
+    m_waiters = &w;
+  }
+  unlock_scheduler();
+  return registered;
+}
+
 void Task::end() {
-  finish();
+  lock_scheduler();
+  signal();
+  // Never switched back to
   m_state = TaskState::Stopped;
+  schedule();
 }
 
 void Task::suspend() {
   lock_scheduler();
-  m_state = TaskState::Waiting;
+  m_state = TaskState::Suspended;
+  SCHED_TRACE(Block, this);
   schedule();
   unlock_scheduler();
 }
 
+// schedule() takes this task out of its ready queue first
 void Task::resume() {
   lock_scheduler();
-  if(next_task == nullptr) {
-    auto cur_task = current_task;
-    current_task = this;
-    task_switch_wrapper(cur_task, this);
-  } else {
-    next_task = this;
+  previous_task = current_task;
+  current_task = this;
+  m_state = TaskState::Running;
+  m_timeslice_start = os::Time::since_boot();
+  if(previous_task != current_task) {
+    task_switch_wrapper(previous_task.get(), this);
   }
   unlock_scheduler();
 }
 
+static ready_queue* highest_ready_queue() {
+  if(!critical_tasks.empty()) return &critical_tasks;
+  if(!realtime_tasks.empty()) return &realtime_tasks;
+  if(!normal_tasks.empty()) return &normal_tasks;
+  if(!background_tasks.empty()) return &background_tasks;
+  return nullptr;
+}
+
 static task_ref find_next_task() {
-  os::std::priority_queue<task_ref>* queue = nullptr;
-  if(!critical_tasks.empty()) {
-    queue = &critical_tasks;
-  } else if(!realtime_tasks.empty()) {
-    queue = &realtime_tasks;
-  } else if(!normal_tasks.empty()) {
-    queue = &normal_tasks;
-  } else if(!background_tasks.empty()) {
-    queue = &background_tasks;
-  }
+  ready_queue* queue = highest_ready_queue();
   assert(queue != nullptr);
   auto ref = queue->top();
   assert(ref->state() == TaskState::Ready);
@@ -253,46 +422,27 @@ static task_ref find_next_task() {
   return ref;
 }
 
-// Critical tasks preempt all tasks which have a lower static priority or dynamic priority, and are never suspended by time limits
-// Realtime tasks preempt all tasks which have a lower static priority or dynamic priority
-// Normal tasks preempt all tasks which have a lower static priority or dynamic priority
-// Background tasks never preempt other tasks
+// A task that stopped running (waiting, suspended, ended or put back in its
+// queue when its timeslice ran out) makes way for the first task of the
+// highest priority queue, which may be itself. A task that is still running
+// keeps the CPU, unless a task with a higher static priority became ready.
+// Within a priority, queues are ordered by dynamic priority.
 void os::Tasking::schedule() {
   if(sched_postponed_counter != 0) {
     sched_postponed = true;
     return;
   }
 
-  next_task = find_next_task();
-
-  if(next_task != nullptr) {
-    next_task->resume();
+  if(current_task->state() == TaskState::Running) {
+    ready_queue* queue = highest_ready_queue();
+    if(queue == nullptr || !(queue->top()->static_priority() > current_task->static_priority())) {
+      return;
+    }
+    current_task->set_state(TaskState::Ready);
+    enqueue_task(current_task);
   }
 
-  /*if(current_task->state() != TaskState::Running) {
-    auto next_task = find_next_task();
-    auto old_task = current_task;
-    current_task = next_task;
-    current_task->set_state(TaskState::Running);
-    old_task->suspend(*current_task);
-  } else {
-    auto next = find_next_task();
-    auto cs = current_task->static_priority();
-    auto cd = current_task->dynamic_priority();
-    auto ns = next->static_priority();
-    auto nd = next->dynamic_priority();
-
-    if(should_preempt(cs, cd, ns, nd)) {
-      current_task->set_state(TaskState::Ready);
-      auto old_task = current_task;
-      current_task = next;
-      current_task->set_state(TaskState::Running);
-      current_task->set_timeslice_start(os::Time::since_boot());
-      old_task->suspend(*current_task);
-    } else {
-      enqueue_task(next);
-    }
-  }*/
+  find_next_task()->resume();
 }
 
 using namespace os::Time;
@@ -305,7 +455,23 @@ void os::Tasking::timer_tick(os::Time::TimeSpan time) {
   auto slice = time - current_task->timeslice_start();
   if(slice > max_timeslice && current_task->static_priority() != TaskPriority::Critical) {
     current_task->decrease_dynamic_priority();
+    SCHED_TRACE(Preempt, current_task);
+    current_task->set_state(TaskState::Ready);
     enqueue_task(current_task);
   }
+  // Also lets a task of a higher priority that was woken since take over.
+  // Postponed until unlock_stuff().
+  schedule();
   unlock_stuff();
+}
+
+void os::Tasking::wake(const task_ref& task) {
+  // Not lock_scheduler: unlocking would enable interrupts inside IRQ handlers
+  os::InterruptGuard guard;
+  // Tasks waiting on a Waitable are left to its finish()
+  if(task->state() == TaskState::Suspended) {
+    task->set_state(TaskState::Ready);
+    SCHED_TRACE(Wake, task);
+    enqueue_task(task);
+  }
 }
\ No newline at end of file
@@ -3,17 +3,25 @@
 #include <stddef.h>
 #include <stdint.h>
 
-#include <vector.h>
-#include <shared_ptr.h>
+#include <small_vector.h>
+#include <intrusive_ptr.h>
+#include <object_pool.h>
+#include <new.h>
+#include <type_traits.h>
+#include <utility.h>
 #include "paging.h"
 #include "time.h"
+#include "fpu.h"
 
 namespace os {
   namespace Tasking {
     enum class TaskState {
       Running,
       Ready,
+      // Blocked on a Waitable, made ready by its finish()
       Waiting,
+      // Blocked in Task::suspend, made ready by wake()
+      Suspended,
       Stopped
     };
 
@@ -24,33 +32,89 @@ namespace os {
       Background
     };
 
+    enum class TaskKind {
+      // Own page directory, with the stack mapped at the top of the address space
+      Isolated,
+      // Shares the kernel's page directory and runs on a one page stack used
+      // through the identity mapping, switching between kernel threads never
+      // reloads CR3
+      KernelThread
+    };
+
     class Task;
 
+    // Tasks count their own references, so that the scheduler can pass them
+    // around (and turn `this` back into a reference) without extra allocations
+    using task_ref = os::intrusive_ptr<Task>;
+
+    // Locates a task in the scheduler's ready queues
+    struct TaskQueueIndex;
+
     class Waitable {
     public:
-      Waitable() : m_wait_list(), m_ready(false) {}
-      const std::vector<std::shared_ptr<Task>>& wait_list() const { return m_wait_list; }
+      // Something other than a task waiting for completion, e.g. an async
+      // operation. notify() is called from finish() with the scheduler locked.
+      struct Waiter {
+        Waiter* next_waiter = nullptr;
+        virtual void notify() = 0;
+      };
+
+      // Almost always zero to two tasks, which then need no allocation
+      using wait_list_type = small_vector<task_ref, 2>;
+
+      Waitable() : m_wait_list(), m_waiters(nullptr), m_ready(false) {}
+      const wait_list_type& wait_list() const { return m_wait_list; }
 
       void wait();
 
+      bool ready() const { return m_ready; }
+
+      /**
+       * \brief Registers \p w to be notified when this finishes, without
+       * blocking the current task
+       *
+       * \return false if this has already finished, in which case \p w is
+       * not registered
+       */
+      bool add_waiter(Waiter& w);
+
     protected:
+      // Marks this finished, makes the waiters ready and lets one of them
+      // take over if it has a higher priority than the caller
       void finish();
 
+      // The same as finish() without the switch, for callers that go on with
+      // their own queue of work anyway (pool workers, executors)
+      void signal();
+
     private:
-      std::vector<std::shared_ptr<Task>> m_wait_list;
+      wait_list_type m_wait_list;
+      Waiter* m_waiters;
       bool m_ready;
     };
 
     struct TaskInfo {
         os::Paging::ThreadData data;
         uint32_t esp;
+        os::Fpu::Context* fpu; // Not used by task_switch, keep after esp
     };
 
-    class Task : public Waitable {
+    class Task : public Waitable, public RefCounted<Task> {
       friend Waitable;
+      friend TaskQueueIndex;
+      friend void task_switch_wrapper(Task* current, Task* next);
     public:
-      ~Task() {
-        os::Paging::freeThread(m_info.data);
+      ~Task();
+
+      // Tasks are created and destroyed often, keep them out of the page
+      // granular heap
+      static void* operator new(size_t size) {
+        assert(size == sizeof(Task));
+        return ObjectPool<Task>::instance().allocate();
+      }
+
+      static void operator delete(void* p) {
+        ObjectPool<Task>::instance().deallocate(static_cast<Task*>(p));
       }
       using function_type = void(void);
 
@@ -58,21 +122,65 @@ namespace os {
       inline uint8_t dynamic_priority() const { return m_dpriority; }
       inline void decrease_dynamic_priority() { if(m_dpriority < 255) m_dpriority++; }
       inline void increase_dynamic_priority() { if(m_dpriority > 0) m_dpriority--; }
+      inline uint32_t id() const { return m_id; }
       inline TaskState state() const { return m_state; }
       inline void set_state(TaskState s) { m_state = s; }
       inline void set_timeslice_start(Time::TimeSpan start) { m_timeslice_start = start; }
       
       inline Time::TimeSpan timeslice_start() const { return m_timeslice_start; }
 
-      static std::shared_ptr<Task> start(function_type* func, TaskPriority priority = TaskPriority::Normal);
-      static std::shared_ptr<Task> create();
+      static task_ref start(function_type* func, TaskPriority priority = TaskPriority::Normal,
+                                         TaskKind kind = TaskKind::Isolated);
+
+      /**
+       * \brief Starts a task running an arbitrary callable, e.g. a lambda with
+       * captured state
+       *
+       * The callable is copied (or moved) into the top of the new task's stack,
+       * no heap allocation is made for it. Like plain entry points, it starts
+       * running with the scheduler locked.
+       *
+       * \param func The callable, invoked with no arguments
+       * \param priority The static priority of the new task
+       * \param kind Whether the task gets its own address space
+       */
+      template<typename F>
+      static task_ref start(F&& func, TaskPriority priority = TaskPriority::Normal,
+                                         TaskKind kind = TaskKind::Isolated);
+
+      static task_ref create();
+      static task_ref current();
+
+      /**
+       * \brief Looks a live task up by its id
+       *
+       * \return The task, or nullptr if no task has that id
+       */
+      static task_ref find(uint32_t id);
 
       void suspend();
       void resume();
       void end();
 
     private:
-      Task() : m_timeslice_start(0), m_just_started(true) {}
+      // Largest callable that Task::start will place on a new task's stack
+      static constexpr size_t max_frame_size = 1024;
+
+      using frame_entry = void(void* frame);
+      using frame_constructor = void(void* dst, void* src);
+
+      static task_ref start_frame(frame_entry* entry, size_t size, size_t align,
+                                               frame_constructor* construct, void* src,
+                                               TaskPriority priority, TaskKind kind);
+
+      template<typename F>
+      static void run_frame(void* frame) {
+        F& func = *static_cast<F*>(frame);
+        func();
+        func.~F();
+      }
+
+      Task() : m_info(), m_timeslice_start(0), m_just_started(true), m_queue_index((size_t)-1) {}
       TaskPriority m_spriority;
       uint8_t m_dpriority;
       TaskState m_state;
@@ -80,8 +188,20 @@ namespace os {
       TaskInfo m_info;
       Time::TimeSpan m_timeslice_start;
       bool m_just_started;
+      size_t m_queue_index; // Position in its ready queue, -1 if not queued
     };
 
+    template<typename F>
+    task_ref Task::start(F&& func, TaskPriority priority, TaskKind kind) {
+      using fn_type = std::remove_cvref_t<F>;
+      static_assert(sizeof(fn_type) <= max_frame_size, "Callable too large for a task's stack frame");
+
+      return start_frame(&run_frame<fn_type>, sizeof(fn_type), alignof(fn_type),
+        [](void* dst, void* src) {
+          new (dst) fn_type(static_cast<F&&>(*static_cast<std::remove_reference_t<F>*>(src)));
+        }, (void*)&func, priority, kind);
+    }
+
     void init();
 
     void lock_scheduler();
@@ -93,5 +213,17 @@ namespace os {
     void schedule();
 
     void timer_tick(os::Time::TimeSpan time);
+
+    /**
+     * \brief Makes a task that blocked in Task::suspend ready to run again
+     *
+     * Does nothing for tasks in any other state, including those waiting on
+     * a Waitable. The task is only queued, no switch happens until the next
+     * schedule().
+     * Safe to call from interrupt handlers.
+     *
+     * \param task The task to wake up
+     */
+    void wake(const task_ref& task);
   }
 }
\ No newline at end of file
@@ -0,0 +1,143 @@
+#include "threadpool.h"
+
+#include <stddef.h>
+#include <percpu.h>
+#include "tasking.h"
+#include "synchro.h"
+
+using namespace os::ThreadPool;
+using os::Tasking::Task;
+
+// One worker per CPU, the task calling Job::execute helps as well
+constexpr size_t num_workers = os::max_cpus;
+
+static os::Tasking::task_ref workers[num_workers];
+
+// Jobs that still have chunks to claim, oldest first
+static Job* queue_head = nullptr;
+static Job* queue_tail = nullptr;
+static os::Spinlock queue_lock;
+
+// Queue lock must be held
+static void unlink_job(Job* job) {
+  if(!job->linked) return;
+
+  Job* prev = nullptr;
+  for(Job* j = queue_head; j != job; j = j->next_job) {
+    prev = j;
+  }
+  if(prev == nullptr) {
+    queue_head = job->next_job;
+  } else {
+    prev->next_job = job->next_job;
+  }
+  if(queue_tail == job) {
+    queue_tail = prev;
+  }
+  job->linked = false;
+}
+
+Job::Job(chunk_function* func, void* context, size_t begin, size_t end, size_t grain)
+    : next_job(nullptr)
+    , linked(false)
+    , m_run(func)
+    , m_context(context)
+    , m_end(end)
+    , m_grain(grain == 0 ? 1 : grain)
+    , m_next(begin)
+    , m_pending((end - begin - 1) / m_grain + 1) {}
+
+bool Job::claim(size_t& begin, size_t& end) {
+  // Never moves past m_end, so that claims after the last chunk can't wrap
+  // the counter around when m_end is close to SIZE_MAX
+  size_t next = m_next.load();
+  do {
+    if(next >= m_end) return false;
+    end = m_end - next > m_grain ? next + m_grain : m_end;
+  } while(!m_next.compare_exchange_weak(next, end));
+
+  begin = next;
+  return true;
+}
+
+bool Job::run(size_t begin, size_t end) {
+  m_run(m_context, begin, end);
+  return m_pending.fetch_sub(1) == 1;
+}
+
+void Job::execute() {
+  Tasking::lock_scheduler();
+  queue_lock.acquire();
+  if(queue_tail == nullptr) {
+    queue_head = this;
+  } else {
+    queue_tail->next_job = this;
+  }
+  queue_tail = this;
+  linked = true;
+  queue_lock.release();
+
+  for(auto& worker : workers) {
+    if(worker) Tasking::wake(worker);
+  }
+  Tasking::unlock_scheduler();
+
+  size_t begin, end;
+  bool done = false;
+  while(claim(begin, end)) {
+    done = run(begin, end);
+  }
+
+  Tasking::lock_scheduler();
+  queue_lock.acquire();
+  unlink_job(this);
+  queue_lock.release();
+  Tasking::unlock_scheduler();
+
+  // If a worker ran the last chunk, it signals completion
+  if(!done) wait();
+}
+
+static void worker_main() {
+  os::Tasking::unlock_scheduler();
+  auto self = Task::current();
+
+  while(true) {
+    os::Tasking::lock_scheduler();
+    queue_lock.acquire();
+    Job* job = nullptr;
+    size_t begin, end;
+    while(queue_head != nullptr) {
+      if(queue_head->claim(begin, end)) {
+        job = queue_head;
+        break;
+      }
+      unlink_job(queue_head);
+    }
+    queue_lock.release();
+
+    if(job == nullptr) {
+      self->suspend();
+      os::Tasking::unlock_scheduler();
+      continue;
+    }
+    os::Tasking::unlock_scheduler();
+
+    // The job stays alive while it has pending chunks: the executing task
+    // only returns after the last one has been signalled
+    if(job->run(begin, end)) {
+      job->complete();
+    }
+  }
+}
+
+void os::ThreadPool::init() {
+  for(auto& worker : workers) {
+    worker = Task::start(&worker_main, os::Tasking::TaskPriority::Normal,
+                         os::Tasking::TaskKind::KernelThread);
+  }
+}
+
+size_t os::ThreadPool::worker_count() {
+  return num_workers;
+}
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <stddef.h>
+#include <atomic.h>
+#include <utility.h>
+#include "tasking.h"
+#include "synchro.h"
+
+namespace os {
+  namespace ThreadPool {
+    /**
+     * \brief A range of indices split in chunks of \p grain elements, which
+     * are claimed one at a time by the pool's workers and by the task that
+     * executes the job
+     */
+    class Job : public Tasking::Waitable {
+    public:
+      using chunk_function = void(void* context, size_t begin, size_t end);
+
+      Job(chunk_function* func, void* context, size_t begin, size_t end, size_t grain);
+
+      /**
+       * \brief Hands the job to the pool, helps running it and returns once
+       * every chunk has completed
+       */
+      void execute();
+
+      /**
+       * \brief Claims the next chunk
+       *
+       * \return false if there were no chunks left to claim
+       */
+      bool claim(size_t& begin, size_t& end);
+
+      /**
+       * \brief Runs a claimed chunk
+       *
+       * \return Whether it was the last chunk of the job to complete
+       */
+      bool run(size_t begin, size_t end);
+
+      // Called from pool workers, which go on with the next job right away
+      void complete() { signal(); }
+
+      Job* next_job;
+      bool linked;
+
+    private:
+      chunk_function* m_run;
+      void* m_context;
+      size_t m_end;
+      size_t m_grain;
+      std::atomic<size_t> m_next;
+      std::atomic<size_t> m_pending;
+    };
+
+    /**
+     * \brief Starts the pool's worker tasks
+     *
+     * Must be called after Tasking::init
+     */
+    void init();
+
+    /**
+     * \brief Returns the number of worker tasks in the pool
+     */
+    size_t worker_count();
+
+    /**
+     * \brief Calls fn(chunk_begin, chunk_end) over [begin, end) split in
+     * chunks of at most \p grain elements, in parallel on the pool
+     *
+     * \p fn may capture state by reference: the call only returns after every
+     * chunk has run.
+     */
+    template<typename Fn>
+    void parallel_for(size_t begin, size_t end, size_t grain, Fn&& fn) {
+      if(begin >= end) return;
+
+      using fn_type = std::remove_reference_t<Fn>;
+      Job job([](void* context, size_t b, size_t e) {
+        (*static_cast<fn_type*>(context))(b, e);
+      }, (void*)&fn, begin, end, grain);
+      job.execute();
+    }
+
+    /**
+     * \brief Computes map(chunk_begin, chunk_end) over [begin, end) split in
+     * chunks of at most \p grain elements, in parallel on the pool, and folds
+     * the partial results into \p identity with \p reduce
+     *
+     * Partial results are combined in completion order, so \p reduce must be
+     * associative and commutative.
+     */
+    template<typename T, typename Map, typename Reduce>
+    T parallel_reduce(size_t begin, size_t end, size_t grain, T identity, Map&& map, Reduce&& reduce) {
+      T result = identity;
+      Spinlock lock;
+
+      parallel_for(begin, end, grain, [&](size_t b, size_t e) {
+        T partial = map(b, e);
+        Tasking::lock_scheduler();
+        lock.acquire();
+        result = reduce(std::move(result), std::move(partial));
+        lock.release();
+        Tasking::unlock_scheduler();
+      });
+
+      return result;
+    }
+  }
+}
@@ -5,6 +5,9 @@
 #include "debug.h"
 #include "tasking.h"
 #include "time.h"
+#include "deferred.h"
+#include "profiler.h"
+#include "synchro.h"
 
 using namespace os::Time;
 
@@ -13,13 +16,21 @@ void timer_handler(os::Interrupts::Registers*);
 static os::Time::TimeSpan timeSinceBoot{0};
 static os::Time::TimeSpan timerPeriod{0};
 
-void timer_handler(os::Interrupts::Registers*) {
+static void timer_softirq(void*) {
+  os::Tasking::timer_tick(os::Time::since_boot());
+}
+
+void timer_handler(os::Interrupts::Registers* regs) {
   timeSinceBoot += timerPeriod;
-  os::Tasking::timer_tick(timeSinceBoot);
+  os::Profiler::sample(regs);
+  // The scheduler bookkeeping runs after the EOI, with interrupts enabled
+  os::Deferred::queue_softirq(&timer_softirq);
   //os::Tasking::switchTasks();
 }
 
 os::Time::TimeSpan os::Time::since_boot() {
+  // 64 bits take two loads, a tick in between would tear the value
+  os::InterruptGuard guard;
   return timeSinceBoot;
 }
 
@@ -1,48 +1,386 @@
 #include <string.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include "memory.h"
+#include "cpu.h"
+#include "fpu.h"
 
-void *memset(void *dst, int val, size_t n) {
+using os::Memory::copy_function;
+using os::Memory::set_function;
+
+// x86 doesn't mind unaligned loads, these let us do them without breaking
+// strict aliasing
+typedef uint32_t __attribute__((may_alias)) word;
+typedef uint32_t __attribute__((may_alias, aligned(1))) unaligned_word;
+
+// Below this size the byte and word loops beat everything else
+constexpr size_t small_size = 64;
+// From this size on the bulk implementation picked at boot is used
+constexpr size_t large_size = 512;
+
+static void *set_bytes(void *dst, int val, size_t n) {
   uint8_t *addr = static_cast<uint8_t*>(dst);
   for(size_t i = 0; i < n; i++) addr[i] = val;
   return dst;
 }
 
-void *memcpy(void *dst, const void *src, size_t n) {
+static void *copy_bytes(void *dst, const void *src, size_t n) {
   const uint8_t *srcaddr = static_cast<const uint8_t*>(src);
   uint8_t *dstaddr = static_cast<uint8_t*>(dst);
   for(size_t i = 0; i < n; i++) dstaddr[i] = srcaddr[i];
   return dst;
 }
 
-char *strcpy(char *dst, const char *src) {
-  size_t i = 0;
-  while(src[i]) {
-    dst[i] = src[i];
-    i++;
+// Aligns the destination, then moves 32 bits at a time
+static void *set_words(void *dst, int val, size_t n) {
+  uint8_t *d = static_cast<uint8_t*>(dst);
+  while(n > 0 && ((uintptr_t)d & 3)) {
+    *d++ = val;
+    n--;
+  }
+
+  uint32_t v = (uint8_t)val * 0x01010101u;
+  word *dw = reinterpret_cast<word*>(d);
+  for(; n >= 16; n -= 16) {
+    dw[0] = v; dw[1] = v; dw[2] = v; dw[3] = v;
+    dw += 4;
+  }
+  for(; n >= 4; n -= 4) *dw++ = v;
+
+  d = reinterpret_cast<uint8_t*>(dw);
+  while(n-- > 0) *d++ = val;
+  return dst;
+}
+
+static void *copy_words(void *dst, const void *src, size_t n) {
+  uint8_t *d = static_cast<uint8_t*>(dst);
+  const uint8_t *s = static_cast<const uint8_t*>(src);
+  while(n > 0 && ((uintptr_t)d & 3)) {
+    *d++ = *s++;
+    n--;
+  }
+
+  word *dw = reinterpret_cast<word*>(d);
+  const unaligned_word *sw = reinterpret_cast<const unaligned_word*>(s);
+  for(; n >= 16; n -= 16) {
+    dw[0] = sw[0]; dw[1] = sw[1]; dw[2] = sw[2]; dw[3] = sw[3];
+    dw += 4;
+    sw += 4;
   }
+  for(; n >= 4; n -= 4) *dw++ = *sw++;
 
+  d = reinterpret_cast<uint8_t*>(dw);
+  s = reinterpret_cast<const uint8_t*>(sw);
+  while(n-- > 0) *d++ = *s++;
+  return dst;
+}
+
+// REP STOSD/MOVSD for the bulk, REP STOSB/MOVSB for the tail
+static void *set_rep(void *dst, int val, size_t n) {
+  void *d = dst;
+  uint32_t v = (uint8_t)val * 0x01010101u;
+  size_t words = n >> 2;
+  size_t rest = n & 3;
+  asm volatile("rep stosl" : "+D"(d), "+c"(words) : "a"(v) : "memory");
+  asm volatile("rep stosb" : "+D"(d), "+c"(rest) : "a"(v) : "memory");
+  return dst;
+}
+
+static void *copy_rep(void *dst, const void *src, size_t n) {
+  void *d = dst;
+  size_t words = n >> 2;
+  size_t rest = n & 3;
+  asm volatile("rep movsl" : "+D"(d), "+S"(src), "+c"(words) :: "memory");
+  asm volatile("rep movsb" : "+D"(d), "+S"(src), "+c"(rest) :: "memory");
+  return dst;
+}
+
+// Enhanced REP MOVSB/STOSB: microcode moves whole cache lines
+static void *set_erms(void *dst, int val, size_t n) {
+  void *d = dst;
+  asm volatile("rep stosb" : "+D"(d), "+c"(n) : "a"(val) : "memory");
+  return dst;
+}
+
+static void *copy_erms(void *dst, const void *src, size_t n) {
+  void *d = dst;
+  asm volatile("rep movsb" : "+D"(d), "+S"(src), "+c"(n) :: "memory");
+  return dst;
+}
+
+// 64 bytes per iteration through xmm0-xmm3, with aligned stores. Each loop
+// is a single asm statement that declares the registers it uses, so the
+// compiler can't touch them between the loads and the stores. The target
+// attribute only allows naming xmm registers, the C++ code around the loops
+// doesn't use SSE.
+__attribute__((target("sse2")))
+static void *set_sse2(void *dst, int val, size_t n) {
+  uint8_t *d = static_cast<uint8_t*>(dst);
+  size_t head = -(uintptr_t)d & 15;
+  if(head > n) head = n;
+  set_words(d, val, head);
+  d += head;
+  n -= head;
+
+  size_t blocks = n / 64;
+  if(blocks > 0) {
+    os::Fpu::KernelSection section;
+    uint32_t v = (uint8_t)val * 0x01010101u;
+    asm volatile(
+      "movd %2, %%xmm0\n\t"
+      "pshufd $0, %%xmm0, %%xmm0\n"
+      "1:\n\t"
+      "movdqa %%xmm0, 0(%0)\n\t"
+      "movdqa %%xmm0, 16(%0)\n\t"
+      "movdqa %%xmm0, 32(%0)\n\t"
+      "movdqa %%xmm0, 48(%0)\n\t"
+      "add $64, %0\n\t"
+      "dec %1\n\t"
+      "jnz 1b"
+      : "+r"(d), "+r"(blocks) : "r"(v) : "xmm0", "memory", "cc");
+  }
+
+  set_words(d, val, n & 63);
+  return dst;
+}
+
+__attribute__((target("sse2")))
+static void *copy_sse2(void *dst, const void *src, size_t n) {
+  uint8_t *d = static_cast<uint8_t*>(dst);
+  const uint8_t *s = static_cast<const uint8_t*>(src);
+  size_t head = -(uintptr_t)d & 15;
+  if(head > n) head = n;
+  copy_words(d, s, head);
+  d += head;
+  s += head;
+  n -= head;
+
+  size_t blocks = n / 64;
+  if(blocks > 0) {
+    os::Fpu::KernelSection section;
+    asm volatile(
+      "1:\n\t"
+      "movdqu 0(%0), %%xmm0\n\t"
+      "movdqu 16(%0), %%xmm1\n\t"
+      "movdqu 32(%0), %%xmm2\n\t"
+      "movdqu 48(%0), %%xmm3\n\t"
+      "movdqa %%xmm0, 0(%1)\n\t"
+      "movdqa %%xmm1, 16(%1)\n\t"
+      "movdqa %%xmm2, 32(%1)\n\t"
+      "movdqa %%xmm3, 48(%1)\n\t"
+      "add $64, %0\n\t"
+      "add $64, %1\n\t"
+      "dec %2\n\t"
+      "jnz 1b"
+      : "+r"(s), "+r"(d), "+r"(blocks) :: "xmm0", "xmm1", "xmm2", "xmm3", "memory", "cc");
+  }
+
+  copy_words(d, s, n & 63);
+  return dst;
+}
+
+// Selected once by os::Memory::init
+static set_function *set_large = set_rep;
+static copy_function *copy_large = copy_rep;
+
+static os::Memory::Variant variant_list[6];
+static size_t variant_count = 0;
+
+void os::Memory::init() {
+  using os::Cpu::Feature;
+
+  variant_count = 0;
+  variant_list[variant_count++] = {"bytes", copy_bytes, set_bytes};
+  variant_list[variant_count++] = {"words", copy_words, set_words};
+  variant_list[variant_count++] = {"rep movsd", copy_rep, set_rep};
+
+  if(os::Cpu::has(Feature::SSE2) && os::Fpu::sseEnabled()) {
+    variant_list[variant_count++] = {"sse2", copy_sse2, set_sse2};
+    set_large = set_sse2;
+    copy_large = copy_sse2;
+  }
+
+  // Fast strings beat vector loops on the CPUs that have them
+  if(os::Cpu::has(Feature::ERMS)) {
+    variant_list[variant_count++] = {"erms", copy_erms, set_erms};
+    set_large = set_erms;
+    copy_large = copy_erms;
+  }
+
+  variant_list[variant_count++] = {"dispatch", memcpy, memset};
+}
+
+const os::Memory::Variant* os::Memory::variants(size_t& count) {
+  count = variant_count;
+  return variant_list;
+}
+
+void *memset(void *dst, int val, size_t n) {
+  if(n < small_size) return set_words(dst, val, n);
+  if(n < large_size) return set_rep(dst, val, n);
+  return set_large(dst, val, n);
+}
+
+void *memcpy(void *dst, const void *src, size_t n) {
+  if(n < small_size) return copy_words(dst, src, n);
+  if(n < large_size) return copy_rep(dst, src, n);
+  return copy_large(dst, src, n);
+}
+
+// Bit tricks to test four bytes at once. Aligned word loads never cross a
+// page boundary, so reading a few bytes past the terminator is safe.
+static inline bool has_zero(uint32_t v) {
+  return ((v - 0x01010101u) & ~v & 0x80808080u) != 0;
+}
+
+static inline uint32_t repeat_byte(uint8_t c) {
+  return c * 0x01010101u;
+}
+
+static inline bool word_aligned(const void *p) {
+  return ((uintptr_t)p & 3) == 0;
+}
+
+char *strcpy(char *dst, const char *src) {
+  memcpy(dst, src, strlen(src) + 1);
   return dst;
 }
 
 int strcmp(const char *str1, const char *str2) {
-  size_t i = 0;
-  while(str1[i] && str2[i]) {
-    if(str1[i] < str2[i]) return -1;
-    else if(str1[i] > str2[i]) return 1;
+  const uint8_t *p1 = reinterpret_cast<const uint8_t*>(str1);
+  const uint8_t *p2 = reinterpret_cast<const uint8_t*>(str2);
+
+  // Words can only be compared when both strings share the same alignment
+  if(((uintptr_t)p1 & 3) == ((uintptr_t)p2 & 3)) {
+    while(!word_aligned(p1)) {
+      if(*p1 == 0 || *p1 != *p2) return *p1 - *p2;
+      p1++;
+      p2++;
+    }
+
+    const word *w1 = reinterpret_cast<const word*>(p1);
+    const word *w2 = reinterpret_cast<const word*>(p2);
+    while(*w1 == *w2 && !has_zero(*w1)) {
+      w1++;
+      w2++;
+    }
+    p1 = reinterpret_cast<const uint8_t*>(w1);
+    p2 = reinterpret_cast<const uint8_t*>(w2);
+  }
+
+  while(*p1 != 0 && *p1 == *p2) {
+    p1++;
+    p2++;
+  }
+  return *p1 - *p2;
+}
+
+int strncmp(const char *str1, const char *str2, size_t num) {
+  const uint8_t *p1 = reinterpret_cast<const uint8_t*>(str1);
+  const uint8_t *p2 = reinterpret_cast<const uint8_t*>(str2);
+
+  if(((uintptr_t)p1 & 3) == ((uintptr_t)p2 & 3)) {
+    while(num > 0 && !word_aligned(p1)) {
+      if(*p1 == 0 || *p1 != *p2) return *p1 - *p2;
+      p1++;
+      p2++;
+      num--;
+    }
+
+    const word *w1 = reinterpret_cast<const word*>(p1);
+    const word *w2 = reinterpret_cast<const word*>(p2);
+    while(num >= 4 && *w1 == *w2 && !has_zero(*w1)) {
+      w1++;
+      w2++;
+      num -= 4;
+    }
+    p1 = reinterpret_cast<const uint8_t*>(w1);
+    p2 = reinterpret_cast<const uint8_t*>(w2);
+  }
+
+  for(; num > 0; num--) {
+    if(*p1 == 0 || *p1 != *p2) return *p1 - *p2;
+    p1++;
+    p2++;
   }
   return 0;
 }
 
 size_t strlen(const char *str) {
-  size_t i = 0;
-  while(str[i++]) {;}
-  return i;
+  const char *p = str;
+  while(!word_aligned(p)) {
+    if(*p == 0) return p - str;
+    p++;
+  }
+
+  const word *w = reinterpret_cast<const word*>(p);
+  while(!has_zero(*w)) w++;
+
+  p = reinterpret_cast<const char*>(w);
+  while(*p) p++;
+  return p - str;
+}
+
+size_t strnlen(const char *str, size_t max) {
+  // Counts down the bytes left instead of comparing against str + max, which
+  // overflows for large limits such as SIZE_MAX
+  const char *p = str;
+  size_t left = max;
+  while(left > 0 && !word_aligned(p)) {
+    if(*p == 0) return p - str;
+    p++;
+    left--;
+  }
+
+  const word *w = reinterpret_cast<const word*>(p);
+  while(left >= 4 && !has_zero(*w)) {
+    w++;
+    left -= 4;
+  }
+
+  p = reinterpret_cast<const char*>(w);
+  while(left > 0 && *p) {
+    p++;
+    left--;
+  }
+  return p - str;
+}
+
+void *memchr(const void *ptr, int value, size_t num) {
+  const uint8_t *p = static_cast<const uint8_t*>(ptr);
+  uint8_t c = value;
+  while(num > 0 && !word_aligned(p)) {
+    if(*p == c) return (void*)p;
+    p++;
+    num--;
+  }
+
+  uint32_t pattern = repeat_byte(c);
+  const word *w = reinterpret_cast<const word*>(p);
+  while(num >= 4 && !has_zero(*w ^ pattern)) {
+    w++;
+    num -= 4;
+  }
+
+  p = reinterpret_cast<const uint8_t*>(w);
+  for(; num > 0; num--, p++) {
+    if(*p == c) return (void*)p;
+  }
+  return nullptr;
 }
 
 int memcmp ( const void * ptr1, const void * ptr2, size_t num ) {
   const uint8_t *p1 = static_cast<const uint8_t*>(ptr1);
   const uint8_t *p2 = static_cast<const uint8_t*>(ptr2);
+
+  // Skip equal words, the byte loop below finds the first difference
+  while(num >= 4) {
+    if(*reinterpret_cast<const unaligned_word*>(p1) != *reinterpret_cast<const unaligned_word*>(p2)) break;
+    p1 += 4;
+    p2 += 4;
+    num -= 4;
+  }
+
   for(size_t i = 0; i < num; i++) {
     if(*p1 < *p2) return -1;
     if(*p1 > *p2) return 1;
@@ -60,15 +398,22 @@ char * strdup(const char *str1) {
 }
 
 char * strchr (const char * str, int character ) {
-  if(character == 0) {
-    return (char*)(str + strlen(str));
-  } else {
-    while(*str) {
-      if(*str == character) {
-        return (char*)str;
-      }
-      str++;
-    }
+  char c = character;
+  while(!word_aligned(str)) {
+    if(*str == c) return (char*)str;
+    if(*str == 0) return nullptr;
+    str++;
   }
-  return nullptr;
-}
\ No newline at end of file
+
+  // Stop at the first word holding either the character or the terminator
+  uint32_t pattern = repeat_byte(c);
+  const word *w = reinterpret_cast<const word*>(str);
+  while(!has_zero(*w) && !has_zero(*w ^ pattern)) w++;
+
+  str = reinterpret_cast<const char*>(w);
+  while(true) {
+    if(*str == c) return (char*)str;
+    if(*str == 0) return nullptr;
+    str++;
+  }
+}